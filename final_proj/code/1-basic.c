@@ -2,7 +2,9 @@
 #include "equiv-checker.h"
 
 #define NUM_FUNCS 2
+#ifndef NUM_CTX
 #define NUM_CTX 2
+#endif
 
 // USER CODE
 int* global_var;
@@ -5,7 +5,9 @@
 
 #define QUEUE_SIZE 100
 #define NUM_FUNCS 4
+#ifndef NUM_CTX
 #define NUM_CTX 1
+#endif
 
 /// GPT GENERATED circular queue
 
@@ -183,7 +183,9 @@ void init_memory() {
 }
 
 #define NUM_FUNCS 2
+#ifndef NUM_CTX
 #define NUM_CTX 2
+#endif
 
 void notmain() {    
     equiv_checker_init();
@@ -0,0 +1,151 @@
+#include "rpi.h"
+#include "equiv-registry.h"
+
+// Several checks in one image, run back to back in a single boot.
+
+// USER CODE
+int* counter;
+uint32_t* atomic_counter;
+int* global_var;
+int* global_var2;
+
+// racy read-modify-write of a shared counter (same as 1-basic.c)
+EQUIV_USER
+void funcMA(void **arg) {
+    int a = *counter;
+    gcc_mb();
+    a += 1; 
+    a *= 3;
+    a++;
+    gcc_mb();
+    *counter = a;   
+}
+
+EQUIV_USER
+void funcMS(void **arg) {
+    int a = *counter;
+    gcc_mb();
+    a *= 2;
+    a -= 7;
+    a *= 3;
+    gcc_mb();
+    *counter = a;
+}
+
+void init_basic() {
+  *counter = 5;
+}
+
+void setup_basic(equiv_check_t* c) {
+  if(!counter) counter = kmalloc(sizeof(int));
+
+  static function_exec executables[2];
+  executables[0].func_addr = (func_ptr)funcMA;
+  executables[1].func_addr = (func_ptr)funcMS;
+  c->executables = executables;
+
+  c->tags = mk_tags(1);
+  add_tag(&c->tags, counter, "counter");
+}
+
+// two variables updated in opposite orders (same as 2-multivar.c)
+EQUIV_USER
+void funcMV1(void **arg) {
+    int a = *global_var;
+    a += 1; 
+    *global_var = a;   
+
+    int b = *global_var2;
+    b *= 2;
+    *global_var2 = b;
+}
+
+EQUIV_USER
+void funcMV2(void **arg) {
+    int a = *global_var2; 
+    a *= 2;
+    *global_var2 = a;
+
+    int b = *global_var;
+    b += 1;
+    *global_var = b;
+}
+
+void init_multivar() {
+  *global_var = 5;
+  *global_var2 = 10;
+}
+
+void setup_multivar(equiv_check_t* c) {
+  if(!global_var) global_var = kmalloc(sizeof(int));
+  if(!global_var2) global_var2 = kmalloc(sizeof(int));
+
+  static function_exec executables[2];
+  executables[0].func_addr = (func_ptr)funcMV1;
+  executables[1].func_addr = (func_ptr)funcMV2;
+  c->executables = executables;
+
+  c->tags = mk_tags(2);
+  add_tag(&c->tags, global_var, "global 1");
+  add_tag(&c->tags, global_var2, "global 2");
+}
+
+// ldrex/strex increment, should have no invalid schedules (same as 11-armatomic.c)
+EQUIV_USER
+void funcAtomic(void** arg) {
+  atomic_increment(atomic_counter);
+}
+
+void init_atomic() {
+  *atomic_counter = 0;
+}
+
+void setup_atomic(equiv_check_t* c) {
+  if(!atomic_counter) atomic_counter = kmalloc(sizeof(uint32_t));
+
+  static function_exec executables[2];
+  executables[0].func_addr = (func_ptr)funcAtomic;
+  executables[1].func_addr = (func_ptr)funcAtomic;
+  c->executables = executables;
+
+  c->tags = mk_tags(1);
+  add_tag(&c->tags, atomic_counter, "atomic counter");
+}
+
+static equiv_check_t basic = {
+  .name = "basic",
+  .n_funcs = 2,
+  .ncs = 2,
+  .init = init_basic,
+  .setup = setup_basic
+};
+
+static equiv_check_t multivar = {
+  .name = "multivar",
+  .n_funcs = 2,
+  .ncs = 1,
+  .init = init_multivar,
+  .setup = setup_multivar
+};
+
+static equiv_check_t atomic = {
+  .name = "armatomic",
+  .n_funcs = 2,
+  .ncs = 1,
+  .init = init_atomic,
+  .setup = setup_atomic
+};
+
+void notmain() {
+    equiv_checker_init();
+    set_verbosity(1);
+
+    equiv_register(&basic);
+    equiv_register(&multivar);
+    equiv_register(&atomic);
+
+    // NULL runs everything; pass a list of names to pick a subset, e.g.
+    //   const char* names[] = { "armatomic", "basic" };
+    //   equiv_run_checks(names, 2);
+    equiv_run_checks(NULL, 0);
+}
@@ -4,7 +4,9 @@
 #include "equiv-checker.h"
 
 #define NUM_FUNCS 3
+#ifndef NUM_CTX
 #define NUM_CTX 3
+#endif
 
 // USER CODE
 int* global_var;
@@ -4,7 +4,9 @@
 #include "equiv-checker.h"
 
 #define NUM_FUNCS 2
+#ifndef NUM_CTX
 #define NUM_CTX 2
+#endif
 #define load_store_mode 1
 
 int* global_var;
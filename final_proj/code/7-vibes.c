@@ -2,7 +2,9 @@
 #include "equiv-checker.h"
 
 #define NUM_FUNCS 2
+#ifndef NUM_CTX
 #define NUM_CTX 3
+#endif
 
 int* global_var;
 int* global_var2;
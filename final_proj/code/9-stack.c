@@ -5,7 +5,9 @@
 
 #define MAX_STACK_SIZE 100
 #define NUM_FUNCS 2
+#ifndef NUM_CTX
 #define NUM_CTX 2
+#endif
 
 typedef struct {
     int data[MAX_STACK_SIZE];
@@ -83,8 +85,8 @@ void notmain() {
     function_exec *executables = kmalloc(NUM_FUNCS * sizeof(function_exec));
     /*executables[0].func_addr = (func_ptr)funcA;
     executables[1].func_addr = (func_ptr)funcB;*/
-    /*executables[0].func_addr = (func_ptr)funcA_bad;
-    executables[1].func_addr = (func_ptr)funcB_bad;*/
+    executables[0].func_addr = (func_ptr)funcA_bad;
+    executables[1].func_addr = (func_ptr)funcB_bad;
 
     /*set_t* shared_mem_hint = set_alloc();
     add_mem(shared_mem_hint, global_var2, sizeof(int));*/
@@ -96,5 +98,11 @@ void notmain() {
     add_tag(&t, &stack.top, "stack top");
     add_tag(&t, &stack.data, "stack data");
 
+    // One run per starting thread flags the unlocked top/data accesses, then
+    // only those racing bytes are used as switch points
+    set_t* race_sites = set_alloc();
+    if(equiv_checker_find_races(executables, NUM_FUNCS, init_memory, race_sites, &t))
+      equiv_checker_limit_switch_points(race_sites);
+
     equiv_checker_run(executables, NUM_FUNCS, NUM_CTX, init_memory, shared_mem_hint, &t);
 }
@@ -0,0 +1,61 @@
+#!/bin/sh
+# Compares two run-bench.sh result files.
+#
+#   compare.sh <baseline> <results> [threshold-percent]
+#
+# Prints the change of every metric per check. Exits non-zero if usec,
+# cycles_per_trap, traps_per_schedule or heap_peak grew by more than the
+# threshold (default 10%), or if a check failed or disappeared. A change in
+# the number of schedules is reported but is not a performance regression.
+if [ $# -lt 2 ]; then
+  echo "usage: $0 <baseline> <results> [threshold-percent]" >&2
+  exit 2
+fi
+
+awk -v threshold=${3:-10} '
+  function key(   k, i, kv) {
+    k = ""
+    for(i = 1; i <= NF; i++) {
+      split($i, kv, "=")
+      if(kv[1] == "prog" || kv[1] == "ncs" || kv[1] == "check")
+        k = k kv[1] "=" kv[2] " "
+    }
+    return k
+  }
+  function load(arr,   i, kv, k) {
+    k = key()
+    keys[k] = 1
+    for(i = 1; i <= NF; i++) {
+      split($i, kv, "=")
+      arr[k, kv[1]] = kv[2]
+    }
+    arr[k] = 1
+  }
+  NR == FNR { load(base); next }
+            { load(cur) }
+  END {
+    n_metrics = split("schedules traps_per_schedule cycles_per_trap usec heap_peak", metrics, " ")
+    bad = 0
+    for(k in keys) {
+      if(!(k in cur)) { printf "%s missing from results\n", k; bad = 1; continue }
+      if(!(k in base)) { printf "%s new\n", k; continue }
+      if(cur[k, "failed"]) { printf "%s FAILED\n", k; bad = 1; continue }
+      line = k
+      for(m = 1; m <= n_metrics; m++) {
+        name = metrics[m]
+        b = base[k, name]; c = cur[k, name]
+        pct = b > 0 ? (c - b) * 100 / b : 0
+        flag = ""
+        if(name == "schedules") {
+          if(b != c) flag = " (changed)"
+        } else if(pct > threshold) {
+          flag = " REGRESSION"
+          bad = 1
+        }
+        line = line sprintf(" %s=%s(%+.1f%%)%s", name, c, pct, flag)
+      }
+      print line
+    }
+    exit bad
+  }
+' "$1" "$2"
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Runs the benchmark checks and prints one result line per check:
+#
+#   prog=<example> ncs=<bound> check=<n> schedules=... traps=... \
+#     traps_per_schedule=... cycles_per_trap=... usec=... heap_peak=...
+#
+# Every example is rebuilt with -DEQUIV_PERF -DNUM_CTX=<bound> and run with
+# $RUNNER (pi-install by default; point it at a QEMU wrapper to run there).
+#
+#   BENCH_PROGS    examples to run (without .c)
+#   BENCH_CTX      NUM_CTX values
+#   BENCH_TIMEOUT  seconds before a run is abandoned
+set -e
+cd "$(dirname "$0")/.."
+
+RUNNER=${RUNNER:-pi-install}
+BENCH_PROGS=${BENCH_PROGS:-"1-basic 2-multivar 4-array 5-multi-ctx-switch 7-vibes 11-armatomic"}
+BENCH_CTX=${BENCH_CTX:-"1 2 3"}
+BENCH_TIMEOUT=${BENCH_TIMEOUT:-600}
+
+log=$(mktemp)
+trap 'rm -f "$log"' EXIT
+
+for prog in $BENCH_PROGS; do
+  for ncs in $BENCH_CTX; do
+    make -s clean >/dev/null 2>&1 || true
+    make -s PROGS=$prog.c RUN=0 EXTRA_CFLAGS="-DEQUIV_PERF -DNUM_CTX=$ncs" >&2
+    if ! timeout "$BENCH_TIMEOUT" $RUNNER $prog.bin > "$log" 2>&1; then
+      echo "run-bench: $prog with NUM_CTX=$ncs failed or timed out" >&2
+      echo "prog=$prog ncs=$ncs check=0 failed=1"
+      continue
+    fi
+    awk -v prog=$prog -v ncs=$ncs '
+      /^BENCH / { sub(/^BENCH /, ""); print "prog=" prog " ncs=" ncs " check=" n++ " " $0 }
+    ' "$log"
+  done
+done
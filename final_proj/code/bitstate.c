@@ -0,0 +1,68 @@
+#include "bitstate.h"
+
+bitstate_t* bitstate_alloc(uint32_t log2_bits, uint32_t n_hashes) {
+  demand(log2_bits >= 5 && log2_bits <= 22, bitstate array must be 2^5 to 2^22 bits);
+  demand(n_hashes >= 1, need at least one hash);
+
+  bitstate_t* b = kmalloc(sizeof(bitstate_t));
+  b->bits = kmalloc((1 << log2_bits) / 8);
+  b->log2_bits = log2_bits;
+  b->n_hashes = n_hashes;
+  b->n_set = 0;
+  b->max_set = 0;
+  bitstate_clear(b);
+  bitstate_reset_stats(b);
+  return b;
+}
+
+void bitstate_clear(bitstate_t* b) {
+  if(b->n_set > b->max_set) b->max_set = b->n_set;
+  memset(b->bits, 0, (1 << b->log2_bits) / 8);
+  b->n_set = 0;
+}
+
+void bitstate_reset_stats(bitstate_t* b) {
+  b->n_stored = 0;
+  b->n_revisits = 0;
+  b->max_set = 0;
+}
+
+uint32_t bitstate_test_and_set(bitstate_t* b, uint64_t h) {
+  uint32_t mask = (1 << b->log2_bits) - 1;
+  uint32_t h1 = h;
+  // Odd, so the probe sequence doesn't repeat early
+  uint32_t h2 = (h >> 32) | 1;
+
+  uint32_t seen = 1;
+  for(uint32_t i = 0; i < b->n_hashes; i++) {
+    uint32_t bit = (h1 + i * h2) & mask;
+    uint32_t* w = &b->bits[bit / 32];
+    uint32_t m = 1 << (bit % 32);
+    if(!(*w & m)) {
+      seen = 0;
+      *w |= m;
+      b->n_set++;
+    }
+  }
+
+  if(seen) b->n_revisits++;
+  else     b->n_stored++;
+  return seen;
+}
+
+void bitstate_print_stats(const char* msg, bitstate_t* b) {
+  if(msg) printk(msg);
+
+  uint32_t max_set = b->n_set > b->max_set ? b->n_set : b->max_set;
+  enum { PPB = 1000 * 1000 * 1000 };
+  uint64_t fill = (uint64_t)max_set * PPB >> b->log2_bits;
+  // fill^n_hashes, in parts per billion
+  uint64_t p = fill;
+  for(uint32_t i = 1; i < b->n_hashes; i++)
+    p = p * fill / PPB;
+
+  printk("\t%d bits, %d hashes\n", 1 << b->log2_bits, b->n_hashes);
+  printk("\t%d states stored, %d revisits pruned\n", b->n_stored, b->n_revisits);
+  printk("\tfullest: %d bits set (%d ppm)\n", max_set, (uint32_t)(fill / 1000));
+  printk("\tomission probability per state: %d ppb\n", (uint32_t)p);
+}
@@ -0,0 +1,61 @@
+#ifndef __BITSTATE_H
+#define __BITSTATE_H
+
+#include "rpi.h"
+
+/*
+ * Bitstate hashing (as in SPIN) for remembering visited states in constant
+ * memory.
+ *
+ * A state is a 64-bit hash. It is stored by setting n_hashes bits of a fixed
+ * array of 2^log2_bits bits, picked by double hashing of the two halves of
+ * the hash. A state counts as visited if all its bits are set, so distinct
+ * states can be mistaken for each other: with a fraction f of the bits set
+ * the chance is about f^n_hashes. Nothing is ever allocated after
+ * bitstate_alloc, so a big exploration gets less exact instead of running out
+ * of memory.
+ */
+
+// Bit array size, 0 disables bitstate pruning
+#ifndef EQUIV_BITSTATE_LOG2
+#define EQUIV_BITSTATE_LOG2 0
+#endif
+
+#ifndef EQUIV_BITSTATE_HASHES
+#define EQUIV_BITSTATE_HASHES 3
+#endif
+
+typedef struct {
+  uint32_t* bits;
+  uint32_t log2_bits;
+  uint32_t n_hashes;
+  // Bits set since the last clear
+  uint32_t n_set;
+
+  // Stats since the last bitstate_reset_stats
+  uint32_t n_stored;
+  uint32_t n_revisits;
+  // Most bits set before a clear
+  uint32_t max_set;
+} bitstate_t;
+
+/*
+ * Allocates from the kmalloc heap, so this is meant to happen once per boot
+ */
+bitstate_t* bitstate_alloc(uint32_t log2_bits, uint32_t n_hashes);
+
+void bitstate_clear(bitstate_t* b);
+void bitstate_reset_stats(bitstate_t* b);
+
+/*
+ * Stores the state. Returns 1 if it (or a state it can't be told apart from)
+ * was already stored.
+ */
+uint32_t bitstate_test_and_set(bitstate_t* b, uint64_t h);
+
+/*
+ * Prints the stats and the omission probability at the fullest the array got
+ */
+void bitstate_print_stats(const char* msg, bitstate_t* b);
+
+#endif
@@ -0,0 +1,113 @@
+#include "coverage.h"
+#include "equiv-malloc.h"
+
+enum { COV_SWITCH = 1, COV_READ_FROM = 2 };
+
+coverage_t* coverage_alloc(set_t* shared_memory) {
+  coverage_t* cov = equiv_malloc(sizeof(coverage_t));
+  if(!cov) panic("coverage allocation failed!");
+
+  cov->bits = equiv_malloc(COVERAGE_BITS / 8);
+  if(!cov->bits) panic("coverage allocation failed!");
+  memset(cov->bits, 0, COVERAGE_BITS / 8);
+
+  cov->n_covered = 0;
+  cov->n_new = 0;
+  cov->shared_memory = shared_memory;
+  cov->gen = 1;
+  memset(cov->writes, 0, sizeof(cov->writes));
+  return cov;
+}
+
+void coverage_free(coverage_t* cov) {
+  equiv_free(cov->bits);
+  equiv_free(cov);
+}
+
+static void coverage_hit(coverage_t* cov, uint32_t kind, uint32_t a, uint32_t b) {
+  // Mix like the xxhash avalanche so nearby PCs spread over the bitmap
+  uint32_t h = a * 0x9E3779B1 ^ b * 0x85EBCA77 ^ kind;
+  h ^= h >> 15;
+  h *= 0x85EBCA77;
+  h ^= h >> 13;
+  h %= COVERAGE_BITS;
+
+  uint32_t bit = 1 << (h % 32);
+  if(!(cov->bits[h / 32] & bit)) {
+    cov->bits[h / 32] |= bit;
+    cov->n_covered++;
+    cov->n_new++;
+  }
+}
+
+void coverage_begin(coverage_t* cov) {
+  cov->n_new = 0;
+  // Forget every last writer without touching the table
+  cov->gen++;
+}
+
+static coverage_write_t* coverage_write_slot(coverage_t* cov, uint32_t addr) {
+  uint32_t i = (addr * 0x9E3779B1) % COVERAGE_MAX_WRITES;
+  for(uint32_t n = 0; n < COVERAGE_MAX_WRITES; n++) {
+    coverage_write_t* e = &cov->writes[i];
+    if(e->gen != cov->gen || e->addr == addr)
+      return e;
+    i = (i + 1) % COVERAGE_MAX_WRITES;
+  }
+  // Table full, drop the write
+  return NULL;
+}
+
+typedef struct {
+  coverage_t* cov;
+  uint32_t pc;
+  uint32_t w;
+  uint32_t tid;
+} coverage_touch_t;
+
+static void coverage_touch_byte(uint32_t addr, void* arg) {
+  coverage_touch_t* t = arg;
+  coverage_t* cov = t->cov;
+
+  if(!set_lookup(cov->shared_memory, addr)) return;
+
+  coverage_write_t* e = coverage_write_slot(cov, addr);
+  if(!e) return;
+
+  uint32_t live = e->gen == cov->gen;
+  if(t->w) {
+    e->addr = addr;
+    e->pc = t->pc;
+    e->tid = t->tid;
+    e->gen = cov->gen;
+  } else if(live && e->tid != t->tid) {
+    coverage_hit(cov, COV_READ_FROM, e->pc, t->pc);
+  }
+}
+
+void coverage_touch(coverage_t* cov, set_t* touched, uint32_t pc, uint32_t w, uint32_t tid) {
+  coverage_touch_t t = {
+    .cov = cov,
+    .pc = pc,
+    .w = w,
+    .tid = tid
+  };
+  set_foreach(touched, coverage_touch_byte, &t);
+}
+
+uint32_t coverage_end(coverage_t* cov, schedule_t* s, ctx_switch_status_t* status) {
+  let report = s->report;
+  assert(report);
+
+  // Only switches that actually happened have a segment before them. One that
+  // ended early on a block has fewer switch points than its count.
+  for(uint32_t i = 0; i < status->ctx_switch; i++) {
+    uint32_t n = report->n_pcs[i];
+    uint32_t after = report->after_pcs[i];
+    if(n && after) {
+      uint32_t before = report->pcs[i][n - 1];
+      coverage_hit(cov, COV_SWITCH, before, after);
+    }
+  }
+  return cov->n_new;
+}
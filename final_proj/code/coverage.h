@@ -0,0 +1,62 @@
+#ifndef __COVERAGE_H
+#define __COVERAGE_H
+
+#include "rpi.h"
+#include "set.h"
+#include "equiv-threads.h"
+
+/*
+ * Schedule coverage for feedback-directed exploration.
+ *
+ * Two kinds of events are hashed into a bitmap:
+ *  - switch pairs: the last switch point PC before a context switch and the
+ *    first switch point PC after it (from the schedule report)
+ *  - read-from pairs: the PC of a write to shared memory and the PC of a read
+ *    in another thread that saw that write
+ */
+#define COVERAGE_BITS (1 << 16)
+
+// Shared bytes whose last writer is remembered during one schedule
+#define COVERAGE_MAX_WRITES 512
+
+typedef struct {
+  uint32_t addr;
+  uint32_t pc;
+  uint32_t tid;
+  // Entry is live iff gen matches the coverage generation
+  uint32_t gen;
+} coverage_write_t;
+
+typedef struct {
+  uint32_t* bits;
+  // Bits set over all schedules
+  uint32_t n_covered;
+  // Bits first set by the current schedule
+  uint32_t n_new;
+
+  set_t* shared_memory;
+
+  uint32_t gen;
+  coverage_write_t writes[COVERAGE_MAX_WRITES];
+} coverage_t;
+
+coverage_t* coverage_alloc(set_t* shared_memory);
+void coverage_free(coverage_t* cov);
+
+/*
+ * Call before running a schedule
+ */
+void coverage_begin(coverage_t* cov);
+
+/*
+ * Call on every memory touch event of the schedule
+ */
+void coverage_touch(coverage_t* cov, set_t* touched, uint32_t pc, uint32_t w, uint32_t tid);
+
+/*
+ * Call after the schedule ran with a report. Adds its switch pairs and
+ * returns the number of bits the schedule covered first.
+ */
+uint32_t coverage_end(coverage_t* cov, schedule_t* s, ctx_switch_status_t* status);
+
+#endif
@@ -53,7 +53,7 @@ static inline int vibe_check(vibe_check_t *cur_vibes) {
 EQUIV_USER
 static inline void secure_vibes(vibe_check_t *cur_vibes) {
   while(atomic_compare_and_swap(cur_vibes, UNLOCKED, LOCKED) != 0) {
-    sys_equiv_yield();
+    sys_equiv_block(cur_vibes, LOCKED);
   }
 }
 
@@ -6,6 +6,9 @@
 #include "interleaver.h"
 #include "equiv-rw-set.h"
 #include "memory.h"
+#include "equiv-perf.h"
+#include "result-stream.h"
+#include "user-scan.h"
 
 void equiv_copy_user_data() { 
 
@@ -22,15 +25,38 @@ void equiv_copy_user_data() {
 
 }
 
+static uint32_t refinement = 1;
+
+void equiv_checker_set_refinement(uint32_t on) {
+  refinement = on;
+}
+
+static bitstate_t* bitstate = NULL;
+
+// If not NULL, switch points are limited to these bytes
+static set_t* switch_filter = NULL;
+
+void equiv_checker_limit_switch_points(set_t* sites) {
+  switch_filter = sites;
+}
+
+static void* equiv_heap_start = NULL;
+enum { equiv_heap_size = 1024 * 512 };
+
 void equiv_checker_init() {
+  // Page tables and the user data copy only need to happen once per boot
+  if(equiv_heap_start) {
+    equiv_checker_reset();
+    return;
+  }
+
   // Initialize the general heap
   enum { MB = 1024 * 1024 };
   kmalloc_init_set_start((void*)MB, MB);
 
   // Initialize the equiv checker heap
-  uint32_t heap_size = 1024 * 512;
-  void* heap_start = kmalloc(heap_size);
-  equiv_malloc_init(heap_start, heap_size);
+  equiv_heap_start = kmalloc(equiv_heap_size);
+  equiv_malloc_init(equiv_heap_start, equiv_heap_size);
 
   // For now just map the kernel
   procmap_t kernel_map = procmap_default_mk(kern_dom, user_dom); 
@@ -42,12 +68,182 @@ void equiv_checker_init() {
   equiv_copy_user_data();
   printk(" Copy complete.\n");
 
+  // Which .user instructions can touch memory, so single steps over the
+  // rest don't arm the tracker
+  user_scan_init();
+
   // RW tracker
   rw_tracker_init(0);
+
+  perf_init();
+
+  // Fixed size, on the general heap so it survives equiv heap resets
+  if(EQUIV_BITSTATE_LOG2) {
+    bitstate = bitstate_alloc(EQUIV_BITSTATE_LOG2, EQUIV_BITSTATE_HASHES);
+    set_bitstate(bitstate);
+  }
+}
+
+void equiv_checker_reset() {
+  assert(equiv_heap_start);
+
+  result_stream_reset();
+  // Everything on the equiv heap from the previous check is dropped
+  demand(equiv_malloc_init(equiv_heap_start, equiv_heap_size), heap reset failed);
+
+  // The filter lived on the equiv heap
+  switch_filter = NULL;
+
+  // Thread state
+  disable_ctx_switch();
+  rw_tracker_init(0);
+  reset_ntids();
 }
 
 
-void equiv_checker_run(
+// Everything computed before schedules can be explored
+typedef struct {
+  set_t* shared_memory;
+  set_t** switch_points;
+  fp_table_t* valid_hashes;
+  // Switch points each function hits when run alone
+  uint32_t* switch_counts;
+  // Upper bound on instruction counts, used for schedule IDs
+  uint32_t max_instrs;
+  uint32_t start_usec;
+} check_setup_t;
+
+// Switch counts and valid end states for the current shared memory
+static void check_references(
+  check_setup_t* c,
+  function_exec *executables,
+  uint32_t n_func,
+  init_memory_func init
+) {
+  c->switch_counts = equiv_malloc(sizeof(uint32_t) * n_func);
+  find_switch_counts(executables, n_func, c->switch_points, c->switch_counts);
+  c->max_instrs = 1;
+  for(int i = 0; i < n_func; i++)
+    if(c->switch_counts[i] > c->max_instrs) c->max_instrs = c->switch_counts[i];
+
+  const size_t num_perms = factorial(n_func);
+  int **itl = get_func_permutations(n_func);
+
+  c->valid_hashes = fp_table_alloc(64);
+  find_good_hashes(
+    executables, n_func,
+    init,
+    itl, num_perms,
+    c->shared_memory, c->valid_hashes
+  );
+  free_func_permutations(itl, n_func);
+}
+
+static check_setup_t check_setup(
+  function_exec *executables,
+  uint32_t n_func,
+  init_memory_func init,
+  set_t* additional_shared_memory
+) {
+  check_setup_t c;
+  perf_reset();
+  if(bitstate) bitstate_reset_stats(bitstate);
+  equiv_heap_peak_reset();
+  c.start_usec = timer_get_usec();
+
+  c.shared_memory = set_alloc();
+  c.switch_points = equiv_malloc(sizeof(set_t*) * n_func);
+  for(int i = 0; i < n_func; i++)
+    c.switch_points[i] = set_alloc();
+
+  find_shared_memory(executables, n_func, c.shared_memory, c.switch_points);
+  if(additional_shared_memory) {
+    // Hinted memory is a switch point for every thread
+    set_union_inplace(c.shared_memory, additional_shared_memory);
+    for(int i = 0; i < n_func; i++)
+      set_union_inplace(c.switch_points[i], additional_shared_memory);
+  }
+  if(switch_filter) {
+    // The end state still covers all of shared memory
+    for(int i = 0; i < n_func; i++)
+      set_intersection_inplace(c.switch_points[i], switch_filter);
+  }
+
+  check_references(&c, executables, n_func, init);
+  return c;
+}
+
+// Recomputes everything that depends on the shared memory and switch sets
+// after they grew
+static void check_refresh(
+  check_setup_t* c,
+  function_exec *executables,
+  uint32_t n_func,
+  init_memory_func init
+) {
+  fp_table_t* reached = c->valid_hashes;
+  equiv_free(c->switch_counts);
+  check_references(c, executables, n_func, init);
+
+  // End states so far were hashed over the smaller shared memory, so they
+  // can't share a histogram with the new ones. The rerun reaches them again.
+  if(get_verbosity() >= 1)
+    fp_table_print_histogram("\nEnd states before refinement:\n", reached);
+  fp_table_free(reached);
+}
+
+static void check_teardown(check_setup_t* c, uint32_t n_func) {
+  perf_summary("\nCycle counts:\n");
+  perf_bench(timer_get_usec() - c->start_usec, equiv_heap_peak());
+
+  if(get_verbosity() >= 1)
+    fp_table_print_histogram("\nEnd states:\n", c->valid_hashes);
+  if(bitstate && get_verbosity() >= 1)
+    bitstate_print_stats("\nBitstate:\n", bitstate);
+  fp_table_free(c->valid_hashes);
+  equiv_free(c->switch_counts);
+  for(int i = 0; i < n_func; i++)
+    set_free(c->switch_points[i]);
+  equiv_free(c->switch_points);
+  set_free(c->shared_memory);
+
+  // Whatever is still in use now outlives the check
+  if(get_verbosity() >= 1) {
+    equiv_heap_stats_t h;
+    equiv_heap_stats(&h);
+    printk("\nEquiv heap: %d bytes in %d block(s) still used, peak %d of %d\n",
+      h.bytes_used, h.blocks_used, h.bytes_peak, h.size);
+    printk("\t%d bytes free in %d block(s), largest %d, %d%% fragmented\n",
+      h.bytes_free, h.blocks_free, h.largest_free, h.fragmentation_pct);
+  }
+}
+
+uint32_t equiv_checker_find_races(
+  function_exec *executables,
+  uint32_t n_func,
+  init_memory_func init,
+  set_t* sites,
+  memory_tags_t* tags
+) {
+  perf_reset();
+  equiv_heap_peak_reset();
+  uint32_t start_usec = timer_get_usec();
+
+  race_detector_t* rd = race_alloc(n_func, sites);
+  uint32_t n_races = run_races(executables, n_func, init, rd);
+
+  if(get_verbosity() >= 1) {
+    printk("\nRace detection: %d racing PC pair(s)\n", n_races);
+    race_print(rd, tags);
+  }
+  race_free(rd);
+
+  perf_summary("\nCycle counts:\n");
+  perf_bench(timer_get_usec() - start_usec, equiv_heap_peak());
+  return n_races;
+}
+
+uint32_t equiv_checker_run(
   function_exec *executables,
   uint32_t n_func,
   uint32_t ncs,
@@ -57,37 +253,185 @@ void equiv_checker_run(
 ) {
   assert(ncs);
 
-  set_t* shared_memory = set_alloc();
-  find_shared_memory(executables, n_func, shared_memory);
-  if(additional_shared_memory) {
-    set_union_inplace(shared_memory, additional_shared_memory);
-  }
+  check_setup_t c = check_setup(
+    executables, n_func,
+    init,
+    additional_shared_memory
+  );
 
-  const size_t num_perms = factorial(n_func);
-  int **itl = get_func_permutations(n_func);
+  refine_t* refine = refinement ? refine_alloc(c.shared_memory) : NULL;
+  uint32_t sym[n_func];
+  find_symmetric_funcs(executables, n_func, sym);
 
-  set_t* valid_hashes = set_alloc();
-  find_good_hashes(
-    executables, n_func,
+  // One search covers every bound up to ncs, each reported as it is done
+  printk("\nTrying up to %d context switches...\n", ncs);
+  uint32_t n_checked[ncs + 1], n_invalid_at[ncs + 1];
+  for(int i = 0; i <= ncs; i++)
+    n_checked[i] = n_invalid_at[i] = 0;
+  uint32_t n_invalid = run_bounded(
+    executables,
+    n_func,
+    c.valid_hashes,
     init,
-    itl, num_perms,
-    shared_memory, valid_hashes
+    ncs,
+    c.max_instrs,
+    c.shared_memory,
+    c.switch_points,
+    tags,
+    refine,
+    n_checked,
+    n_invalid_at
   );
 
+  // Schedules found shared bytes that the sequential runs missed. Grow the
+  // sets and search again. Every schedule has to be run anyway to find its
+  // children, so each one is checked over the grown shared memory, and the
+  // rerun is reported on its own. Its invalid count replaces the last one.
+  while(refine && refine_pending(refine)) {
+    uint32_t n_found = refine_pending(refine);
+    uint32_t changed = refine_apply(refine, c.switch_points, n_func, sym);
+    if(get_verbosity() >= 1)
+      printk("Found %d more shared byte(s) for threads %x, rerunning\n", n_found, changed);
+
+    check_refresh(&c, executables, n_func, init);
+    // Stream baselines were for the old shared memory
+    result_stream_reset();
+    if(!changed) break;
 
-  for(int i = 1; i <= ncs; i++) {
-    printk("\nTrying %d context switches...\n", i);
-    run_interleavings(
+    for(int i = 0; i <= ncs; i++)
+      n_checked[i] = n_invalid_at[i] = 0;
+    n_invalid = run_bounded(
       executables,
       n_func,
-      valid_hashes,
+      c.valid_hashes,
       init,
-      i,
-      shared_memory,
-      tags
+      ncs,
+      c.max_instrs,
+      c.shared_memory,
+      c.switch_points,
+      tags,
+      refine,
+      n_checked,
+      n_invalid_at
     );
   }
 
-  set_free(valid_hashes);
-  set_free(shared_memory);
+  if(refine) {
+    if(refine->n_dropped && get_verbosity() >= 1)
+      printk("Refinement dropped %d access(es), consider a shared memory hint\n", refine->n_dropped);
+    if(refine->n_full && get_verbosity() >= 1)
+      printk("Refinement found more than %d missed shared bytes at once, %d conflict(s) not added, consider a shared memory hint\n",
+        REFINE_MAX_FOUND, refine->n_full);
+    refine_free(refine);
+  }
+
+  check_teardown(&c, n_func);
+  return n_invalid;
+}
+
+uint64_t equiv_checker_run_ids(
+  function_exec *executables,
+  uint32_t n_func,
+  uint32_t ncs,
+  uint32_t max_instrs,
+  uint64_t first_id,
+  uint64_t n_ids,
+  init_memory_func init,
+  set_t* additional_shared_memory,
+  memory_tags_t* tags
+) {
+  check_setup_t c = check_setup(
+    executables, n_func,
+    init,
+    additional_shared_memory
+  );
+
+  if(!max_instrs) max_instrs = c.max_instrs;
+  schedule_space_t space = schedule_space_mk(n_func, ncs, max_instrs);
+
+  printk("\nSchedule space with %d context switches, %d instructions: ",
+    ncs, max_instrs);
+  print_schedule_id(NULL, schedule_space_size(&space));
+  printk(" schedules\n");
+
+  uint64_t next = run_schedule_ids(
+    executables, n_func,
+    c.valid_hashes,
+    init,
+    &space,
+    first_id, n_ids,
+    c.shared_memory,
+    c.switch_points,
+    tags
+  );
+
+  check_teardown(&c, n_func);
+  return next;
+}
+
+void equiv_checker_run_pct(
+  function_exec *executables,
+  uint32_t n_func,
+  uint32_t depth,
+  uint32_t seed,
+  uint32_t max_runs,
+  uint32_t budget_usec,
+  init_memory_func init,
+  set_t* additional_shared_memory,
+  memory_tags_t* tags
+) {
+  check_setup_t c = check_setup(
+    executables, n_func,
+    init,
+    additional_shared_memory
+  );
+
+  printk("\nSampling schedules with PCT, depth %d, seed %x...\n", depth, seed);
+  pct_t pct = pct_mk(n_func, c.switch_counts, depth, seed);
+  run_pct(
+    executables, n_func,
+    c.valid_hashes,
+    init,
+    &pct,
+    max_runs, budget_usec,
+    c.shared_memory,
+    c.switch_points,
+    tags
+  );
+
+  check_teardown(&c, n_func);
+}
+
+void equiv_checker_run_fuzz(
+  function_exec *executables,
+  uint32_t n_func,
+  uint32_t ncs,
+  uint32_t seed,
+  uint32_t max_runs,
+  uint32_t budget_usec,
+  init_memory_func init,
+  set_t* additional_shared_memory,
+  memory_tags_t* tags
+) {
+  check_setup_t c = check_setup(
+    executables, n_func,
+    init,
+    additional_shared_memory
+  );
+
+  printk("\nFuzzing schedules with %d context switches, seed %x...\n", ncs, seed);
+  schedule_space_t space = schedule_space_mk(n_func, ncs, c.max_instrs);
+  run_fuzz(
+    executables, n_func,
+    c.valid_hashes,
+    init,
+    &space,
+    seed,
+    max_runs, budget_usec,
+    c.shared_memory,
+    c.switch_points,
+    tags
+  );
+
+  check_teardown(&c, n_func);
 }
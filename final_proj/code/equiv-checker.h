@@ -5,12 +5,127 @@
 #include "equiv-checker-util.h"
 #include "interleaver.h"
 
+/*
+ * One-time setup (heaps, page tables, user data copy). Calling it again
+ * only does equiv_checker_reset.
+ *
+ * Building with -DEQUIV_BITSTATE_LOG2=n also sets aside a 2^n bit array for
+ * bitstate pruning in equiv_checker_run (see bitstate.h). Runs that reach a
+ * state at a context switch that was explored before are stopped, so memory
+ * use stays constant and the teardown reports the chance that a state was
+ * wrongly taken for a visited one.
+ */
 void equiv_checker_init(void);
 
-void equiv_checker_run(
+/*
+ * Drops everything on the equiv heap and resets thread state so another
+ * check can run in the same boot. Sets, tags and hints from earlier checks
+ * are invalid afterwards.
+ */
+void equiv_checker_reset(void);
+
+/*
+ * Turns adaptive shared memory refinement in equiv_checker_run on or off.
+ * On by default.
+ */
+void equiv_checker_set_refinement(uint32_t on);
+
+/*
+ * Happens-before race detection (see race.h) as a cheap pre-pass: runs the
+ * functions once per starting thread without preemption and prints the
+ * racing PC pairs. Returns the number of pairs. If sites is not NULL, the
+ * racing bytes and the synchronization words are added to it, ready for
+ * equiv_checker_limit_switch_points.
+ */
+uint32_t equiv_checker_find_races(
+  function_exec *executables,
+  uint32_t n_func,
+  init_memory_func init,
+  set_t* sites,
+  memory_tags_t* tags
+);
+
+/*
+ * Only bytes in sites are switch points in later checks (NULL lifts the
+ * limit). End states are still compared over all of shared memory. Switching
+ * only at race sites and synchronization words skips interleavings of
+ * accesses that are ordered anyway.
+ */
+void equiv_checker_limit_switch_points(set_t* sites);
+
+/*
+ * Explores every schedule with up to ncs context switches in one pass (see
+ * run_bounded) and prints the results per number of switches. Returns the
+ * number of schedules that ended in an invalid state.
+ *
+ * Unless refinement is turned off, bytes that one thread writes and another
+ * accesses in some schedule are added to shared memory even if the
+ * sequential runs never shared them, so most checks need no hint. The search
+ * is then run again and every schedule is checked over the grown shared
+ * memory. Each rerun prints its own totals per number of switches, and the
+ * invalid count returned is that of the last pass.
+ */
+uint32_t equiv_checker_run(
+  function_exec *executables,
+  uint32_t n_func,
+  uint32_t ncs,
+  init_memory_func init,
+  set_t* additional_shared_memory,
+  memory_tags_t* tags
+);
+
+/*
+ * Runs the schedules with IDs [first_id, first_id + n_ids) with ncs context
+ * switches. Instruction counts range over [1, max_instrs]; if max_instrs is 0
+ * it is the largest number of switch points any function hits when run
+ * alone. Returns the first ID that was not run, which can be passed back in
+ * to resume. A reported schedule ID is replayed with n_ids = 1.
+ */
+uint64_t equiv_checker_run_ids(
+  function_exec *executables,
+  uint32_t n_func,
+  uint32_t ncs,
+  uint32_t max_instrs,
+  uint64_t first_id,
+  uint64_t n_ids,
+  init_memory_func init,
+  set_t* additional_shared_memory,
+  memory_tags_t* tags
+);
+
+/*
+ * Randomized alternative to equiv_checker_run for checks too big to
+ * enumerate. Samples schedules with PCT priority change points (depth - 1 of
+ * them) using a seeded PRNG, so a run is reproduced by its seed. Stops after
+ * max_runs schedules or budget_usec microseconds, whichever comes first (0
+ * disables a limit).
+ */
+void equiv_checker_run_pct(
+  function_exec *executables,
+  uint32_t n_func,
+  uint32_t depth,
+  uint32_t seed,
+  uint32_t max_runs,
+  uint32_t budget_usec,
+  init_memory_func init,
+  set_t* additional_shared_memory,
+  memory_tags_t* tags
+);
+
+/*
+ * Coverage-guided schedule fuzzing with ncs context switches. Schedules that
+ * exercise new (switch PC, switch PC) or read-from pairs are kept and mutated.
+ * Stops after max_runs schedules (skipped non-canonical ones included) or
+ * budget_usec microseconds (0 disables a limit). The same seed gives the same
+ * run.
+ */
+void equiv_checker_run_fuzz(
   function_exec *executables,
   uint32_t n_func,
   uint32_t ncs,
+  uint32_t seed,
+  uint32_t max_runs,
+  uint32_t budget_usec,
   init_memory_func init,
   set_t* additional_shared_memory,
   memory_tags_t* tags
@@ -3,17 +3,39 @@
 #include <stdint.h>
 
 #include "equiv-malloc.h"
+#include "equiv-perf.h"
+
+/* Segregated fit allocator
+ * ------------------------
+ * Free blocks are kept in per size-class free lists. A size maps to a first
+ * level class (its highest set bit) and one of SL_COUNT linear second level
+ * classes within it. Two levels of bitmaps record which lists are non-empty,
+ * so finding a list with a block that fits is a couple of bit scans and both
+ * allocation and free take constant time.
+ *
+ * Every block starts with a one word header holding its size and flags.
+ * Free blocks also keep their size in their last word (a boundary tag) so a
+ * freed block can find and merge with a free left neighbour in O(1). Payloads
+ * are ALIGNMENT aligned.
+ *
+ * Build with EQUIV_MALLOC_DEBUG to validate the whole heap on every call.
+ */
 
 #define STATUS_FREE 0x1
-#define STATUS_USED 0x0
-#define STATUS_MASK 0x1
-#define SIZE_MASK ~STATUS_MASK
+#define STATUS_PREV_FREE 0x2
+#define FLAG_MASK 0x7
+#define SIZE_MASK ~FLAG_MASK
 
-/* While in implicit this was convenience to avoid
- * zero sized blocks, this is now crucial to give enough
- * space in the free blocks for our pointers!
- */
-#define MINIMUM_PAYLOAD 8 + 8 // 2 pointers
+#define ALIGNMENT_LOG2 3
+
+// Linear subdivisions of each power of two
+#define SL_LOG2 3
+#define SL_COUNT (1 << SL_LOG2)
+
+// Sizes below SMALL_SIZE all live in first level class 0
+#define FL_SHIFT (SL_LOG2 + ALIGNMENT_LOG2)
+#define SMALL_SIZE (1 << FL_SHIFT)
+#define FL_COUNT (32 - FL_SHIFT + 1)
 
 /* Type definitions */
 
@@ -22,18 +44,30 @@ typedef struct header_t header_t;
 typedef header_t *header_ptr;
 struct header_t {
   metadata_t metadata;
-  header_ptr previous_free;
+  // Only valid in free blocks
   header_ptr next_free;
+  header_ptr previous_free;
 };
 
+// Header, both free list pointers and the boundary tag (16 bytes)
+#define MINIMUM_BLOCK (sizeof(header_t) + sizeof(metadata_t))
+
 typedef struct heap_t {
-  header_ptr first_free;
   size_t     size;
   header_ptr base;
+  // Zero sized used block after the last real block
+  header_ptr end;
+
+  uint32_t   fl_bitmap;
+  uint32_t   sl_bitmap[FL_COUNT];
+  header_ptr free_lists[FL_COUNT][SL_COUNT];
+
   int        blocks_used;
   int        blocks_free;
   size_t     bytes_used;
   size_t     bytes_free;
+  // High-water mark of bytes_used
+  size_t     bytes_peak;
 } heap_t;
 
 typedef unsigned char status_t;
@@ -52,242 +86,214 @@ size_t roundup(size_t sz, size_t mult) {
     return (sz + mult - 1) & ~(mult - 1);
 }
 
-/*
- * Function: get_status
- * --------------------
- * This function returns the status of a block
+/* Function: fls
+ * -------------
+ * Index of the highest set bit of a non-zero word.
  */
-status_t get_status(header_ptr header) {
-  return header->metadata & STATUS_MASK;
+static inline uint32_t fls(uint32_t x) {
+  return 31 - __builtin_clz(x);
 }
 
-/*
- * Function: get_size
- * ------------------
- * This function returns the size of a block
+/* Function: ffs_index
+ * -------------------
+ * Index of the lowest set bit of a non-zero word.
  */
-size_t get_size(header_ptr header) {
+static inline uint32_t ffs_index(uint32_t x) {
+  return __builtin_ctz(x);
+}
+
+static inline size_t get_size(header_ptr header) {
   return header->metadata & SIZE_MASK;
 }
 
-/*
- * Function: set_status
- * --------------------
- * This function modifies the status of a block in-place
- */
-void set_status(header_ptr header, status_t status) {
-  header->metadata = get_size(header) | (status & STATUS_MASK);
+static inline int is_free(header_ptr header) {
+  return header->metadata & STATUS_FREE;
 }
 
-/*
- * Function: set_size
- * ------------------
- * This function modifies the size of a block in-place
- */
-void set_size(header_ptr header, size_t size) {
-  header->metadata = (size & SIZE_MASK) | get_status(header);
+static inline int is_prev_free(header_ptr header) {
+  return header->metadata & STATUS_PREV_FREE;
+}
+
+static inline void set_flag(header_ptr header, metadata_t flag, int on) {
+  if (on) header->metadata |= flag;
+  else    header->metadata &= ~flag;
 }
 
 /*
- * Function: get_payload_start
- * ---------------------------
- * This function computes the pointer to the first payload byte of a used block. If
- * header is a free block, behavior is undefined.
+ * Function: make_block
+ * --------------------
+ * Writes a header with the given size and free status, keeping the
+ * previous-free flag. Free blocks also get their boundary tag.
  */
-void *get_payload_start(header_ptr header) {
+static void make_block(header_ptr header, size_t size, int free) {
+  header->metadata = size | (header->metadata & STATUS_PREV_FREE);
+  set_flag(header, STATUS_FREE, free);
+  if (free) {
+    metadata_t *tag = (metadata_t *)((char *)header + size) - 1;
+    *tag = size;
+  }
+}
+
+static inline void *get_payload_start(header_ptr header) {
   return (char *)header + sizeof(metadata_t);
 }
 
-/*
- * Function: get_payload_end
- * -------------------------
- * This function computes the pointer to the first byte after the payload of
- * a block.
- */
-void *get_payload_end(header_ptr header) {
-  size_t offset = sizeof(metadata_t) + get_size(header);
-  char *end = (char *)header + offset;
-  return (void *)end;
+static inline header_ptr header_of_payload(void *payload) {
+  return (header_ptr)((char *)payload - sizeof(metadata_t));
+}
+
+static inline header_ptr next_block(header_ptr header) {
+  return (header_ptr)((char *)header + get_size(header));
 }
 
 /*
- * Function: header_of_payload
- * ---------------------------
- * This function computes the pointer to the header of a given payload. The
- * payload pointer is expected to be the first byte of the payload. If it is
- * not, behavior is undefined. If payload is in a free block, behavior is
- * undefined.
+ * Function: prev_block
+ * --------------------
+ * Finds the left neighbour from its boundary tag. Only valid if it is free.
  */
-header_ptr header_of_payload(void *payload) {
-  return (header_ptr)((char *)payload - sizeof(metadata_t));
+static inline header_ptr prev_block(header_ptr header) {
+  metadata_t size = *((metadata_t *)header - 1);
+  return (header_ptr)((char *)header - size);
 }
 
-/* Function: make_block
- * --------------------
- * This function is a shorthand to set the size and status of a block at location
- * loc at the same time
+/*
+ * Function: mapping
+ * -----------------
+ * Computes the size class of a block size.
  */
-void make_block(header_ptr loc, status_t status, size_t size) {
-  set_size(loc, size);
-  set_status(loc, status);
+static void mapping(size_t size, uint32_t *fl, uint32_t *sl) {
+  if (size < SMALL_SIZE) {
+    *fl = 0;
+    *sl = size / (SMALL_SIZE / SL_COUNT);
+  } else {
+    uint32_t f = fls(size);
+    *sl = (size >> (f - SL_LOG2)) ^ SL_COUNT;
+    *fl = f - FL_SHIFT + 1;
+  }
 }
 
-/* Function: next_free_block
- * -------------------------
- * This function advances a header pointer to the address of the next free block.
- * If there is no next free block (i.e. header is the last free block), this
- * function returns NULL. Otherwise, header is updated in place to point to
- * the next free block and the updated pointer is returned.
- *
- * If header is not free, behavior is undefined.
+/*
+ * Function: mapping_search
+ * ------------------------
+ * Like mapping, but rounds up to the next class boundary first so every
+ * block in the resulting class is big enough for size.
  */
-header_ptr next_free_block(header_ptr *header) {
-  header_ptr header_p = *header;
-  // Get next block
-  header_ptr next = header_p->next_free;
-  if (next == NULL) {
-    return NULL;
+static void mapping_search(size_t size, uint32_t *fl, uint32_t *sl) {
+  if (size >= SMALL_SIZE) {
+    size += (1 << (fls(size) - SL_LOG2)) - 1;
   }
-  // Update in-place and return new header
-  *header = next;
-  return next;
+  mapping(size, fl, sl);
 }
 
-/* Function: remove_free_block
+/*
+ * Function: insert_free_block
  * ---------------------------
- * This function removes a free block from the free list. If header
- * is a used block, behavior is undefined
+ * Pushes a free block on the list of its class.
  */
-void remove_free_block(header_ptr header) {
-  header_ptr previous = header->previous_free;
-  header_ptr next = header->next_free;
-  if (previous == NULL) {
-    // a NULL previous indicates that this is the first
-    // free block and we should update our global accordingly
-    heap.first_free = next;
-  } else {
-    previous->next_free = next;
-  }
-  if (next != NULL) {
-    next->previous_free = previous;
-  }
+static void insert_free_block(header_ptr header) {
+  uint32_t fl, sl;
+  mapping(get_size(header), &fl, &sl);
+
+  header_ptr head = heap.free_lists[fl][sl];
+  header->next_free = head;
+  header->previous_free = NULL;
+  if (head) head->previous_free = header;
+  heap.free_lists[fl][sl] = header;
+
+  heap.fl_bitmap |= 1 << fl;
+  heap.sl_bitmap[fl] |= 1 << sl;
 }
 
-/* Function: append_free_block
+/*
+ * Function: remove_free_block
  * ---------------------------
- * This function appends a free block to the free list. If
- * header is a used block, behavior is undefined
+ * Unlinks a free block from the list of its class.
  */
-void append_free_block(header_ptr header) {
-  header_ptr old_first_free = heap.first_free;
-  if (old_first_free != NULL) {
-    header->next_free = old_first_free;
-    header->previous_free = NULL;
+static void remove_free_block(header_ptr header) {
+  uint32_t fl, sl;
+  mapping(get_size(header), &fl, &sl);
 
-    old_first_free->previous_free = header;
+  header_ptr previous = header->previous_free;
+  header_ptr next = header->next_free;
+  if (previous) previous->next_free = next;
+  else          heap.free_lists[fl][sl] = next;
+  if (next) next->previous_free = previous;
+
+  if (!heap.free_lists[fl][sl]) {
+    heap.sl_bitmap[fl] &= ~(1 << sl);
+    if (!heap.sl_bitmap[fl]) heap.fl_bitmap &= ~(1 << fl);
   }
-  heap.first_free = header;
 }
 
-/* Function: next_block
- * --------------------
- * This function computes the address of the next block. If the next block is a
- * valid one (i.e. not off the heap), header is updated in-place to point to
- * the next block and its address is returned. However, if the block is invalid,
- * header is left unmodified and NULL is returned.
+/*
+ * Function: find_free_block
+ * -------------------------
+ * Returns a free block of at least size bytes from the smallest non-empty
+ * class that is guaranteed to fit, or NULL.
  */
-header_ptr next_block(header_ptr *header) {
-  void *end = get_payload_end(*header);
-  // Is the end in bounds?
-  if ((char *)end >= (char *)heap.base + heap.size) {
-    return NULL;
+static header_ptr find_free_block(size_t size) {
+  uint32_t fl, sl;
+  mapping_search(size, &fl, &sl);
+  if (fl >= FL_COUNT) return NULL;
+
+  uint32_t sl_map = heap.sl_bitmap[fl] & (~0u << sl);
+  if (!sl_map) {
+    // Nothing in this first level class, take the next bigger one
+    uint32_t fl_map = fl + 1 < 32 ? heap.fl_bitmap & (~0u << (fl + 1)) : 0;
+    if (!fl_map) return NULL;
+    fl = ffs_index(fl_map);
+    sl_map = heap.sl_bitmap[fl];
   }
-  // Update in-place and return new header
-  *header = (header_ptr)end;
-  return (header_ptr)end;
+  sl = ffs_index(sl_map);
+  return heap.free_lists[fl][sl];
 }
 
-/* Function: coalesce_right
+/*
+ * Function: block_size_for
  * ------------------------
- * This function coalesces the free blocks to the right of block base into
- * block base. Each coalesce occurs in O(1) time, however the entire operation
- * is O(n) with n free blocks to the right of base. After the function has
- * finished, base is guaranteeed to be a free block that is immediately
- * succeeded by a used block or the end of the heap.
+ * Block size needed for a payload of requested_size bytes.
  */
-void coalesce_right(header_ptr base) {
-  header_ptr next = base;
-  while(next_block(&next) != NULL && get_status(next) == STATUS_FREE) {
-    // Coalesce this block in O(1)
-    size_t new_space = get_size(next) + sizeof(metadata_t);
-    set_size(base, get_size(base) + new_space);
-    remove_free_block(next);
-
-    // Update stats
-    heap.blocks_free--;
-    heap.bytes_free += sizeof(metadata_t);
-  }
+static size_t block_size_for(size_t requested_size) {
+  size_t size = roundup(requested_size + sizeof(metadata_t), ALIGNMENT);
+  return size < MINIMUM_BLOCK ? MINIMUM_BLOCK : size;
 }
 
-/* Funtion: trim_block_if_possible
- * -------------------------------
- * This function computes the excess space at the end of a block after needs
- * bytes has been allocated and creates a new free block out of said space if
- * it is possible.
+/*
+ * Function: split_block
+ * ---------------------
+ * Trims a used block down to size bytes if the excess can hold a block of
+ * its own. The excess is freed (and merged with a free right neighbour).
  */
-void trim_block_if_possible(header_ptr header, size_t needs) {
-  size_t size = get_size(header);
-
-  size_t excess = size - needs;
-  if (excess >= sizeof(metadata_t) + MINIMUM_PAYLOAD) {
-    // Our current block should be resized
-    set_size(header, needs);
-
-    // Make our new block at the end of our resized current block
-    size_t excess_payload = excess - sizeof(metadata_t);
-    // (we can make this cast because new_block is guaranteed to be
-    // within the extent of our old block, thus it will always be valid)
-    header_ptr new_block = (header_ptr)get_payload_end(header);
-    make_block(new_block, STATUS_FREE, excess_payload);
-
-    // Replace this free block in the free list with our new free block
-    // (yes header is technically in use but it is effectively free)
-    append_free_block(new_block);
-
-    // Update stat variables
-    heap.blocks_free++;
-    heap.bytes_free += excess_payload;
-    heap.bytes_used -= excess; // we entirely lose sizeof(metadata_t) bytes
+static void split_block(header_ptr header, size_t size) {
+  size_t excess = get_size(header) - size;
+  if (excess < MINIMUM_BLOCK) {
+    return;
   }
-}
-
-/* Function: allocate_block
- * ------------------------
- * This function allocates needs bytes in the block header. header must
- * already be a free block, otherwise behavior is undefined. The block
- * will be trimmed if possible and a new free block created with excess
- * space. A pointer to the first payload byte is returned.
- */
-void *allocate_block(header_ptr header, size_t needs) {
-  size_t size = get_size(header);
 
-  set_status(header, STATUS_USED);
+  make_block(header, size, 0);
+  heap.bytes_used -= excess;
 
-  // Update stat variables
-  heap.blocks_free--;
+  header_ptr rest = next_block(header);
+  rest->metadata = 0;
+  make_block(rest, excess, 0);
   heap.blocks_used++;
-  heap.bytes_free -= size;
-  heap.bytes_used += size;
-
-  // Can we make a new block?
-  trim_block_if_possible(header, needs);
-
-  // header is now inuse
-  remove_free_block(header);
+  heap.bytes_used += excess;
+  equiv_free(get_payload_start(rest));
+}
 
-  return get_payload_start(header);
+static void update_peak(void) {
+  if (heap.bytes_used > heap.bytes_peak) {
+    heap.bytes_peak = heap.bytes_used;
+  }
 }
 
+#ifdef EQUIV_MALLOC_DEBUG
+uint32_t validate_heap();
+#define check_heap() demand(validate_heap(), equiv heap is corrupt)
+#else
+#define check_heap() do { } while(0)
+#endif
+
 /* Allocator Implementation */
 
 /*
@@ -298,114 +304,120 @@ void *allocate_block(header_ptr header, size_t needs) {
  * heap state is valid, it returns 1.
  */
 uint32_t equiv_malloc_init(void *heap_start, size_t heap_size) {
-  // We must be bigger than our minimum size
-  size_t minimum_size = sizeof(header_t) + MINIMUM_PAYLOAD;
-  if (heap_size < minimum_size) {
+  // Headers sit one word before an aligned payload
+  uintptr_t start = roundup((uintptr_t)heap_start + sizeof(metadata_t), ALIGNMENT)
+                    - sizeof(metadata_t);
+  uintptr_t limit = (uintptr_t)heap_start + heap_size;
+  if (limit < start + MINIMUM_BLOCK + sizeof(metadata_t)) {
+    return 0;
+  }
+  // The end marker is a header too
+  uintptr_t end = (limit & ~(ALIGNMENT - 1)) - sizeof(metadata_t);
+  if (end < start + MINIMUM_BLOCK) {
     return 0;
   }
 
-  // Initialize empty heap
-  heap.base = heap_start;
-  heap.first_free = heap_start;
-  heap.size = heap_size;
-  heap.bytes_used = 0;
-  heap.blocks_used = 0;
-  heap.bytes_free = 0;
-  heap.bytes_used = 0;
-
-  // The size of the first block is the entire heap minus the
-  // size of the metadatadata
-  size_t first_block_size = heap_size - sizeof(metadata_t);
+  memset(&heap, 0, sizeof(heap));
+  heap.base = (header_ptr)start;
+  heap.end = (header_ptr)end;
+  heap.size = end - start;
 
-  // Make our block
-  make_block((header_ptr)heap.base, STATUS_FREE, first_block_size);
+  heap.base->metadata = 0;
+  make_block(heap.base, heap.size, 1);
+  insert_free_block(heap.base);
 
-  // NULL initialize first linked list element
-  heap.first_free->previous_free = NULL;
-  heap.first_free->next_free = NULL;
+  heap.end->metadata = STATUS_PREV_FREE;
 
-  // Update statistics
-  heap.bytes_free = first_block_size;
   heap.blocks_free = 1;
-
+  heap.bytes_free = heap.size;
   return 1;
 }
 
 /*
  * Function: equiv_malloc
  * ------------------
- * This function satisfies an allocation request by searching all known
- * free blocks for the free block closest in size to the requested size.
- * If one is found but it is too large, this function with split the free
- * block to ony allocate the requested size (plus overhead) and nothing more.
- * In either case, it will return a pointer to the first byte of allocated
- * space if a suitable block is found, otherwise it returns NULL.
+ * This function satisfies an allocation request from the smallest size class
+ * that is guaranteed to fit the request, splitting off the excess as a new
+ * free block. Returns a pointer to the first byte of the payload, or NULL if
+ * no free block is big enough.
  *
  * A request of size 0 or of a size greater than MAX_REQUEST_SIZE is not
  * serviced and NULL is returned.
  */
 void *equiv_malloc(size_t requested_size) {
-    // Validate
-    if (requested_size == 0 || requested_size > MAX_REQUEST_SIZE) {
-      return NULL;
-    }
+  if (requested_size == 0 || requested_size > MAX_REQUEST_SIZE) {
+    return NULL;
+  }
+  PERF_START(MALLOC);
 
-    // Minimum size
-    if (requested_size < MINIMUM_PAYLOAD) {
-      requested_size = MINIMUM_PAYLOAD;
-    }
+  size_t needs = block_size_for(requested_size);
+  header_ptr block = find_free_block(needs);
+  if (block == NULL) {
+    PERF_STOP(MALLOC);
+    return NULL;
+  }
 
-    // Align requested size (roundup)
-    size_t needs = roundup(requested_size, ALIGNMENT);
+  remove_free_block(block);
+  size_t size = get_size(block);
+  make_block(block, size, 0);
+  set_flag(next_block(block), STATUS_PREV_FREE, 0);
 
-    // Loop over free blocks to find the best one
-    header_ptr best_block = NULL;
-    size_t best_difference = SIZE_MAX;
-    header_ptr current_block = heap.first_free;
-    do {
-      size_t size = get_size(current_block);
-      if (size >= needs && size - needs < best_difference) {
-        best_difference = size - needs;
-        best_block = current_block;
-      }
-    } while(next_free_block(&current_block) != NULL);
+  heap.blocks_free--;
+  heap.blocks_used++;
+  heap.bytes_free -= size;
+  heap.bytes_used += size;
 
-    // If we found a valid block, allocate it
-    if (best_block != NULL) {
-      return allocate_block(best_block, needs);
-    }
+  split_block(block, needs);
+  update_peak();
+  check_heap();
 
-    // We could not service the request, so return NULL
-    return NULL;
+  PERF_STOP(MALLOC);
+  return get_payload_start(block);
 }
 
 /* Function: equiv_free
  * ----------------
- * This function services a free request by flagging the provided block
- * as free and coalescing all free blocks to its right into it. If ptr
+ * This function services a free request by merging the block with free
+ * neighbours on both sides and putting the result on its class list. If ptr
  * is NULL, nothing is done the function returns immediately.
  */
 void equiv_free(void *ptr) {
   if (ptr == NULL) {
     return;
   }
+  PERF_START(FREE);
 
-  // Free
-  header_ptr base = header_of_payload(ptr);
-  size_t size = get_size(base);
-  set_status(base, STATUS_FREE);
+  header_ptr block = header_of_payload(ptr);
+  size_t size = get_size(block);
 
-  // Add to free list
-  append_free_block(base);
-
-  // Update stats
   heap.blocks_used--;
+  heap.bytes_used -= size;
   heap.blocks_free++;
   heap.bytes_free += size;
-  heap.bytes_used -= size;
 
-  // Coalesce right
-  coalesce_right(base);
+  // Merge right
+  header_ptr next = next_block(block);
+  if (is_free(next)) {
+    remove_free_block(next);
+    size += get_size(next);
+    heap.blocks_free--;
+  }
+
+  // Merge left
+  if (is_prev_free(block)) {
+    header_ptr prev = prev_block(block);
+    remove_free_block(prev);
+    size += get_size(prev);
+    block = prev;
+    heap.blocks_free--;
+  }
+
+  make_block(block, size, 1);
+  set_flag(next_block(block), STATUS_PREV_FREE, 1);
+  insert_free_block(block);
+  check_heap();
+
+  PERF_STOP(FREE);
 }
 
 /*
@@ -413,11 +425,10 @@ void equiv_free(void *ptr) {
  * -------------------
  * This function services a reallocation request. If the current allocation is
  * large enough to hold new_size, the same allocation is returned. Otherwise,
- * equiv_realloc will coalesce free blocks to the right of the current allocation into
- * the current allocation. If the post-coalesce block is large enough to hold
- * new_size, it is returned. If it is not, equiv_realloc will allocate a new block
- * to service the request. If this is not possible, it will return NULL, otherwise,
- * it will return the newly allocated block.
+ * equiv_realloc will absorb a free block to the right of the current allocation
+ * if that makes it big enough. If it does not, equiv_realloc will allocate a new
+ * block to service the request. If this is not possible, it will return NULL,
+ * otherwise, it will return the newly allocated block.
  *
  * If old_ptr is NULL, the request is treated as an allocation request of size
  * new_size, and if new_size is 0 it is treated as a free request of old_ptr.
@@ -436,125 +447,161 @@ void *equiv_realloc(void *old_ptr, size_t new_size) {
     return NULL;
   }
 
-  // We assume that ptr is a valid payload pointer
-  header_ptr header = header_of_payload(old_ptr);
-
-  // Validate & align size
   if (new_size > MAX_REQUEST_SIZE) {
     return NULL;
   }
-  size_t needs = roundup(new_size, ALIGNMENT);
+  size_t needs = block_size_for(new_size);
 
   // Is the block already big enough?
+  header_ptr header = header_of_payload(old_ptr);
   size_t old_size = get_size(header);
   if (old_size >= needs) {
     return old_ptr;
   }
 
-  // Absorb free blocks to the right
-  header_ptr right = header_of_payload(old_ptr);
-  size_t additional_space = 0;
-  if (next_block(&right) != NULL && get_status(right) == STATUS_FREE) {
-    coalesce_right(right);
-
-    // How much space did we gain?
-    additional_space = get_size(right) + sizeof(metadata_t);
-
-    // Merge the free block into the current block
-    remove_free_block(right);
-    set_size(header, old_size + additional_space);
+  // Absorb a free block to the right
+  header_ptr next = next_block(header);
+  if (is_free(next) && old_size + get_size(next) >= needs) {
+    size_t gained = get_size(next);
+    remove_free_block(next);
+    make_block(header, old_size + gained, 0);
+    set_flag(next_block(header), STATUS_PREV_FREE, 0);
 
-    // Update stats
     heap.blocks_free--;
-    heap.bytes_free -= get_size(right);
-    heap.bytes_used += additional_space;
-  }
-
-  old_size += additional_space;
+    heap.bytes_free -= gained;
+    heap.bytes_used += gained;
 
-
-  // Did we make enough space?
-  if (needs <= old_size) {
-    // Trim down to just what we need
-    trim_block_if_possible(header, needs);
+    split_block(header, needs);
+    update_peak();
+    check_heap();
     return old_ptr;
   }
 
   // Try to find a new spot
-  void *new_block = equiv_malloc(needs);
+  void *new_block = equiv_malloc(new_size);
   if (new_block == NULL) {
     return NULL;
   }
 
-  // If we could service the request, move the data
-  // We use old_size since that's guaranteed to all be payload
-  memcpy(new_block, old_ptr, old_size);
-
-  // Free the old allocation
+  // Everything after the header of the old block is payload
+  memcpy(new_block, old_ptr, old_size - sizeof(metadata_t));
   equiv_free(old_ptr);
-
-  // Whew all done!
   return new_block;
 }
 
+/* Statistics */
+
+size_t equiv_heap_peak(void) {
+  return heap.bytes_peak;
+}
+
+void equiv_heap_peak_reset(void) {
+  heap.bytes_peak = heap.bytes_used;
+}
+
+/*
+ * Function: largest_free_block
+ * ----------------------------
+ * Size of the largest free block. Scans one free list, so only for stats.
+ */
+static size_t largest_free_block(void) {
+  if (!heap.fl_bitmap) return 0;
+  uint32_t fl = fls(heap.fl_bitmap);
+  uint32_t sl = fls(heap.sl_bitmap[fl]);
+
+  size_t largest = 0;
+  for (header_ptr b = heap.free_lists[fl][sl]; b; b = b->next_free) {
+    if (get_size(b) > largest) largest = get_size(b);
+  }
+  return largest;
+}
+
+void equiv_heap_stats(equiv_heap_stats_t *stats) {
+  stats->size = heap.size;
+  stats->blocks_used = heap.blocks_used;
+  stats->blocks_free = heap.blocks_free;
+  stats->bytes_used = heap.bytes_used;
+  stats->bytes_free = heap.bytes_free;
+  stats->bytes_peak = heap.bytes_peak;
+  stats->largest_free = largest_free_block();
+  // Share of free memory that is not in the largest free block
+  stats->fragmentation_pct = heap.bytes_free ?
+    100 - (uint32_t)((uint64_t)stats->largest_free * 100 / heap.bytes_free) : 0;
+}
+
 /* Validation Code */
 
+#ifdef EQUIV_MALLOC_DEBUG
 uint32_t validate_heap() {
-    /* Validate whole heap */
-    size_t header_bytes = (heap.blocks_used + heap.blocks_free) * sizeof(metadata_t);
-    size_t payload_bytes = heap.bytes_used + heap.bytes_free;
-
-    // All three of these cases should be impossible in a valid heap
+    int n_used = 0, n_free = 0;
+    size_t bytes_used = 0, bytes_free = 0;
 
-    // Check for no used blocks but bytes used
-    if (heap.blocks_used == 0 && heap.bytes_used > 0) {
-      
-      return 0;
+    /* Validate individual blocks */
+    int prev_free = 0;
+    header_ptr current_block = heap.base;
+    while (current_block != heap.end) {
+      size_t size = get_size(current_block);
+      if (size < MINIMUM_BLOCK || size % ALIGNMENT || size > heap.size) {
+        return 0;
+      }
+      if ((uintptr_t)get_payload_start(current_block) % ALIGNMENT) {
+        return 0;
+      }
+      // Flag must match the left neighbour and free blocks never touch
+      if (!!is_prev_free(current_block) != prev_free) {
+        return 0;
+      }
+      if (is_free(current_block)) {
+        if (prev_free) return 0;
+        metadata_t *tag = (metadata_t *)next_block(current_block) - 1;
+        if (*tag != size) return 0;
+        n_free++;
+        bytes_free += size;
+      } else {
+        n_used++;
+        bytes_used += size;
+      }
+      prev_free = is_free(current_block);
+      current_block = next_block(current_block);
+      if ((char *)current_block > (char *)heap.end) {
+        return 0;
+      }
     }
-    // Check for no free blocks but bytes free
-    if (heap.blocks_free == 0 && heap.bytes_free > 0) {
-      
+    if (!!is_prev_free(heap.end) != prev_free) {
       return 0;
     }
-    // Check for missing bytes
-    if (header_bytes + payload_bytes != heap.size) {
-      
+
+    // Stats must add up
+    if (n_used != heap.blocks_used || n_free != heap.blocks_free ||
+        bytes_used != heap.bytes_used || bytes_free != heap.bytes_free ||
+        bytes_used + bytes_free != heap.size) {
       return 0;
     }
 
-    /* Validate free list */
-    int n_free = 0;
-    header_ptr current_free_block = heap.first_free;
-    do {
-      // Every free list block must be free
-      status_t status = get_status(current_free_block);
-      if (status != STATUS_FREE) {
-        
-        return 0;
+    /* Validate free lists */
+    int n_listed = 0;
+    for (uint32_t fl = 0; fl < FL_COUNT; fl++) {
+      for (uint32_t sl = 0; sl < SL_COUNT; sl++) {
+        header_ptr b = heap.free_lists[fl][sl];
+        // Bitmaps must agree with the lists
+        if (!!b != !!(heap.sl_bitmap[fl] & (1 << sl))) return 0;
+        for (; b; b = b->next_free) {
+          uint32_t bfl, bsl;
+          mapping(get_size(b), &bfl, &bsl);
+          if (!is_free(b) || bfl != fl || bsl != sl) return 0;
+          n_listed++;
+        }
       }
-      n_free++;
-    } while(next_free_block(&current_free_block) != NULL);
-    // We should have counted the same amount of free blocks
-    if (n_free != heap.blocks_free) {
-      
+      if (!!heap.sl_bitmap[fl] != !!(heap.fl_bitmap & (1 << fl))) return 0;
+    }
+    if (n_listed != heap.blocks_free) {
       return 0;
     }
 
-    /* Validate individual blocks */
-    header_ptr current_block = heap.base;
-    do {
-      // Sanity check block size
-      size_t size = get_size(current_block);
-      if (size >= heap.size || size == 0) {
-        
-        return 0;
-      }
-    } while(next_block(&current_block) != NULL);
-
-
     /* Everything is good. Yay! */
     return 1;
 }
+#endif
 
 /*
  * Function: dump_block
@@ -565,14 +612,13 @@ uint32_t validate_heap() {
 void dump_block(header_ptr header) {
   // Print block header
   size_t size = get_size(header);
-  status_t status = get_status(header);
   printk("Block @ %x = %x : %d bytes : %c\n",
     header,
     header->metadata,
     size,
-    status == STATUS_FREE ? 'F' : 'U'
+    is_free(header) ? 'F' : 'U'
   );
-  if (status == STATUS_FREE) {
+  if (is_free(header)) {
     printk("\t P: %x\n\t N: %x\n", header->previous_free, header->next_free);
   }
 }
@@ -585,25 +631,17 @@ void dump_block(header_ptr header) {
  * information about each block within it.
  */
 void equiv_dump_heap() {
-  header_ptr current_block = heap.base;
+  equiv_heap_stats_t stats;
+  equiv_heap_stats(&stats);
+
   printk("--- Heap ---\n");
   printk("Expected Size: %d bytes\n", heap.size);
-  printk("Used: %d blocks / %d bytes\n", heap.blocks_used, heap.bytes_used);
-  printk("Free: %d blocks / %d bytes\n", heap.blocks_free, heap.bytes_free);
-  printk("\t First Free: %x\n", heap.first_free);
+  printk("Used: %d blocks / %d bytes (peak %d)\n",
+    stats.blocks_used, stats.bytes_used, stats.bytes_peak);
+  printk("Free: %d blocks / %d bytes (largest %d, %d%% fragmented)\n",
+    stats.blocks_free, stats.bytes_free, stats.largest_free, stats.fragmentation_pct);
   printk("--- Blocks ---\n");
-  int skipped_zeros = 0;
-  do {
-    // Skip zero blocks
-    if (current_block->metadata == 0) {
-      skipped_zeros++;
-      continue;
-    }
-    if (skipped_zeros > 0) {
-      printk("Skipped %d zero blocks\n", skipped_zeros);
-      skipped_zeros = 0;
-    }
-    dump_block(current_block);
-  } while(next_block(&current_block) != NULL);
-
+  for (header_ptr b = heap.base; b != heap.end; b = next_block(b)) {
+    dump_block(b);
+  }
 }
@@ -19,4 +19,23 @@ void* equiv_realloc(void *old_ptr, size_t new_size);
 void equiv_free(void *ptr);
 void equiv_dump_heap();
 
+typedef struct {
+  size_t size;
+  int blocks_used;
+  int blocks_free;
+  // Block sizes, including headers
+  size_t bytes_used;
+  size_t bytes_free;
+  size_t bytes_peak;
+  size_t largest_free;
+  // Percentage of free bytes outside the largest free block
+  uint32_t fragmentation_pct;
+} equiv_heap_stats_t;
+
+void equiv_heap_stats(equiv_heap_stats_t *stats);
+
+// Most bytes in use at once since init or the last reset
+size_t equiv_heap_peak(void);
+void equiv_heap_peak_reset(void);
+
 #endif
@@ -0,0 +1,97 @@
+#include "equiv-perf.h"
+#include "mini-step.h"
+
+#ifdef EQUIV_PERF
+
+perf_timer_t perf_timers[PERF_N_TIMERS];
+uint32_t perf_events[PERF_N_EVENTS];
+
+static const char* timer_names[PERF_N_TIMERS] = {
+  [PERF_MISMATCH_FAULT] = "mismatch fault",
+  [PERF_DATA_ABORT] = "data abort",
+  [PERF_CTX_SWITCH] = "ctx switch handler",
+  [PERF_HASH_MEM] = "hash_mem",
+  [PERF_MALLOC] = "equiv_malloc",
+  [PERF_FREE] = "equiv_free",
+  [PERF_INIT] = "init",
+};
+
+static const char* event_names[PERF_N_EVENTS] = {
+  [PERF_EV_PREFETCH_ABORT] = "prefetch aborts",
+  [PERF_EV_FAST_STEP] = "fast steps",
+  [PERF_EV_DATA_ABORT] = "data aborts",
+  [PERF_EV_DACR_TOGGLE] = "DACR toggles",
+  [PERF_EV_DECODE_MISS] = "decode cache misses",
+  [PERF_EV_SWITCH] = "context switches",
+  [PERF_EV_YIELD] = "yields",
+  [PERF_EV_BLOCK] = "blocks",
+  [PERF_EV_SCHEDULE] = "schedules",
+};
+
+void perf_init(void) {
+  // Performance monitor control: enable (bit 0), reset the cycle counter (bit 2)
+  uint32_t pmnc = 0b101;
+  asm volatile("mcr p15, 0, %0, c15, c12, 0" :: "r"(pmnc));
+  perf_reset();
+}
+
+void perf_reset(void) {
+  memset(perf_timers, 0, sizeof(perf_timers));
+  memset(perf_events, 0, sizeof(perf_events));
+  step_fast.n = 0;
+}
+
+// printk has no 64-bit formats
+static void print_u64(uint64_t v) {
+  char buf[21];
+  int i = sizeof(buf) - 1;
+  buf[i] = 0;
+  do {
+    buf[--i] = '0' + v % 10;
+    v /= 10;
+  } while(v);
+  printk("%s", &buf[i]);
+}
+
+void perf_summary(const char* msg) {
+  if(msg) printk(msg);
+  perf_events[PERF_EV_FAST_STEP] = step_fast.n;
+  uint32_t n_sched = perf_events[PERF_EV_SCHEDULE];
+
+  printk("\t%s\tcalls\tcycles\tmean\tmax\tper schedule\n", "timer");
+  for(int i = 0; i < PERF_N_TIMERS; i++) {
+    perf_timer_t* t = &perf_timers[i];
+    printk("\t%s\t%d\t", timer_names[i], t->n);
+    print_u64(t->cycles);
+    printk("\t%d\t%d\t", t->n ? (uint32_t)(t->cycles / t->n) : 0, t->max);
+    if(n_sched) print_u64(t->cycles / n_sched);
+    else printk("-");
+    printk("\n");
+  }
+
+  printk("\t%s\ttotal\tper schedule\n", "event");
+  for(int i = 0; i < PERF_N_EVENTS; i++) {
+    printk("\t%s\t%d\t", event_names[i], perf_events[i]);
+    if(n_sched) printk("%d\n", perf_events[i] / n_sched);
+    else printk("-\n");
+  }
+}
+
+void perf_bench(uint32_t usec, uint32_t heap_peak) {
+  uint32_t n_sched = perf_events[PERF_EV_SCHEDULE];
+  uint32_t timed = perf_events[PERF_EV_PREFETCH_ABORT] + perf_events[PERF_EV_DATA_ABORT];
+  // Fast steps are traps too, but their cycles aren't timed
+  uint32_t traps = timed + step_fast.n;
+  uint64_t trap_cycles = perf_timers[PERF_MISMATCH_FAULT].cycles +
+                         perf_timers[PERF_DATA_ABORT].cycles;
+
+  printk("BENCH schedules=%d traps=%d traps_per_schedule=%d cycles_per_trap=%d usec=%d heap_peak=%d\n",
+    n_sched,
+    traps,
+    n_sched ? traps / n_sched : 0,
+    timed ? (uint32_t)(trap_cycles / timed) : 0,
+    usec,
+    heap_peak);
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef __EQUIV_PERF_H
+#define __EQUIV_PERF_H
+
+#include "rpi.h"
+
+/*
+ * Cycle counter instrumentation of the checker's hot paths.
+ *
+ * Build with -DEQUIV_PERF to enable. Otherwise every macro and call below
+ * compiles to nothing.
+ *
+ * Timers use the ARM1176 cp15 cycle counter (c15, c12, 1). They are
+ * inclusive: a data abort that calls the ctx switch handler counts those
+ * cycles in both. A timer is started and stopped by name and must not
+ * nest with itself.
+ */
+enum {
+  PERF_MISMATCH_FAULT,   // prefetch abort entry until the thread resumes
+  PERF_DATA_ABORT,       // rw_tracker_data_abort_handler
+  PERF_CTX_SWITCH,       // ctx_switch_handler
+  PERF_HASH_MEM,         // hash_mem
+  PERF_MALLOC,           // equiv_malloc
+  PERF_FREE,             // equiv_free
+  PERF_INIT,             // user init() between schedules
+  PERF_N_TIMERS
+};
+
+enum {
+  PERF_EV_PREFETCH_ABORT,
+  PERF_EV_FAST_STEP,      // taken by the asm fast path, see mini-step.h
+  PERF_EV_DATA_ABORT,
+  PERF_EV_DACR_TOGGLE,
+  PERF_EV_DECODE_MISS,
+  PERF_EV_SWITCH,
+  PERF_EV_YIELD,
+  PERF_EV_BLOCK,
+  PERF_EV_SCHEDULE,
+  PERF_N_EVENTS
+};
+
+#ifdef EQUIV_PERF
+
+typedef struct {
+  uint32_t n;
+  uint64_t cycles;
+  uint32_t max;
+  uint32_t start;
+  uint32_t running;
+} perf_timer_t;
+
+extern perf_timer_t perf_timers[PERF_N_TIMERS];
+extern uint32_t perf_events[PERF_N_EVENTS];
+
+static inline uint32_t perf_cycles(void) {
+  uint32_t c;
+  asm volatile("mrc p15, 0, %0, c15, c12, 1" : "=r"(c));
+  return c;
+}
+
+static inline void perf_timer_start(perf_timer_t* t) {
+  t->start = perf_cycles();
+  t->running = 1;
+}
+
+static inline void perf_timer_stop(perf_timer_t* t) {
+  if(!t->running) return;
+  uint32_t c = perf_cycles() - t->start;
+  t->running = 0;
+  t->n++;
+  t->cycles += c;
+  if(c > t->max) t->max = c;
+}
+
+#define PERF_START(name) perf_timer_start(&perf_timers[PERF_##name])
+#define PERF_STOP(name) perf_timer_stop(&perf_timers[PERF_##name])
+#define PERF_EVENT(name) (perf_events[PERF_EV_##name]++)
+
+// Enables the cycle counter
+void perf_init(void);
+void perf_reset(void);
+// Totals, means and per-schedule figures since the last reset
+void perf_summary(const char* msg);
+// One machine readable "BENCH key=value ..." line for bench/run-bench.sh
+void perf_bench(uint32_t usec, uint32_t heap_peak);
+
+#else
+
+#define PERF_START(name) do { } while(0)
+#define PERF_STOP(name) do { } while(0)
+#define PERF_EVENT(name) do { } while(0)
+
+static inline void perf_init(void) { }
+static inline void perf_reset(void) { }
+static inline void perf_summary(const char* msg) { }
+static inline void perf_bench(uint32_t usec, uint32_t heap_peak) { }
+
+#endif
+
+#endif
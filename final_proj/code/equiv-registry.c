@@ -0,0 +1,64 @@
+#include "equiv-registry.h"
+
+static equiv_check_t* checks[EQUIV_MAX_CHECKS];
+static uint32_t n_checks = 0;
+
+void equiv_register(equiv_check_t* check) {
+  if(n_checks == EQUIV_MAX_CHECKS)
+    panic("too many checks registered, max is %d\n", EQUIV_MAX_CHECKS);
+  assert(check->name && check->setup && check->init);
+  checks[n_checks++] = check;
+}
+
+static equiv_check_t* find_check(const char* name) {
+  for(uint32_t i = 0; i < n_checks; i++)
+    if(strcmp(checks[i]->name, name) == 0)
+      return checks[i];
+  return NULL;
+}
+
+static uint32_t run_check(equiv_check_t* check) {
+  printk("\n=== Check %s ===\n", check->name);
+  equiv_checker_init();
+
+  check->executables = NULL;
+  check->hint = NULL;
+  check->tags = (memory_tags_t){ 0 };
+  check->setup(check);
+  assert(check->executables);
+
+  return equiv_checker_run(
+    check->executables,
+    check->n_funcs,
+    check->ncs,
+    check->init,
+    check->hint,
+    &check->tags
+  );
+}
+
+uint32_t equiv_run_checks(const char** names, uint32_t n_names) {
+  uint32_t n_run = names ? n_names : n_checks;
+  equiv_check_t* run[n_run];
+  uint32_t invalid[n_run];
+
+  // Resolve every name before spending time on checks
+  for(uint32_t i = 0; i < n_run; i++) {
+    run[i] = names ? find_check(names[i]) : checks[i];
+    if(!run[i])
+      panic("no check named %s\n", names[i]);
+  }
+
+  uint32_t n_failed = 0;
+  for(uint32_t i = 0; i < n_run; i++) {
+    invalid[i] = run_check(run[i]);
+    if(invalid[i]) n_failed++;
+  }
+
+  printk("\n=== Summary ===\n");
+  for(uint32_t i = 0; i < n_run; i++)
+    printk("\t%s\t%s (%d invalid schedules)\n",
+      run[i]->name, invalid[i] ? "FAIL" : "ok", invalid[i]);
+  printk("%d of %d checks found invalid schedules\n", n_failed, n_run);
+  return n_failed;
+}
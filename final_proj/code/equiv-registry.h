@@ -0,0 +1,36 @@
+#ifndef __EQUIV_REGISTRY_H
+#define __EQUIV_REGISTRY_H
+
+#include "rpi.h"
+#include "equiv-checker.h"
+
+/*
+ * Registry of named checks so one image can run a whole suite in a single
+ * boot. The equiv heap and thread state are reset between checks.
+ */
+#define EQUIV_MAX_CHECKS 64
+
+typedef struct equiv_check {
+  const char* name;
+  uint32_t n_funcs;
+  uint32_t ncs;
+  init_memory_func init;
+
+  // Fills in executables, hint and tags. Runs after the equiv heap is reset,
+  // so anything allocated with equiv_malloc (sets, tags) is built here.
+  void (*setup)(struct equiv_check* check);
+  function_exec* executables;
+  set_t* hint;
+  memory_tags_t tags;
+} equiv_check_t;
+
+void equiv_register(equiv_check_t* check);
+
+/*
+ * Runs the registered checks named in names, in that order, or all of them
+ * in registration order if names is NULL. Returns the number of checks that
+ * found invalid schedules.
+ */
+uint32_t equiv_run_checks(const char** names, uint32_t n_names);
+
+#endif
@@ -5,88 +5,137 @@
 #include "armv6-debug-impl.h"
 #include "interleaver.h"
 #include "equiv-threads.h"
+#include "equiv-perf.h"
+#include "user-scan.h"
+#include "mini-step.h"
+#include "mem-emulate.h"
+#include "equiv-uart.h"
 
 static uint32_t rw_tracker_enabled;
 
 static rw_tracker_t current_tracker;
 
-static void get_touched_bytes(uint32_t instruction, uint32_t addr, set_t* destination_set) {
-  // TODO: Alignment?????
+mem_access_t mem_access_decode(uint32_t instruction) {
+  mem_access_t a = { 0 };
+  uint32_t l = bit_isset(instruction, 20);
 
-  // A4-213 SWP
-  if(bits_get(instruction, 20, 27) == 0b00010000) {
-    for(int i = 0; i < 4; i++)
-      set_insert(destination_set, addr + i);
-  }
-  // A4-214 SWPB
-  else if(bits_get(instruction, 20, 27) == 0b00010100) {
-    set_insert(destination_set, addr);
+  // A3-41 unconditional instructions: PLD never faults, the rest aren't
+  // loads or stores we track
+  if(bits_get(instruction, 28, 31) == 0b1111)
+    return a;
+
+  // A4-213 SWP / A4-214 SWPB
+  if((instruction & 0x0fb00ff0) == 0x01000090) {
+    a.kind = MEM_SWAP;
+    a.n_bytes = bit_isset(instruction, 22) ? 1 : 4;
+    a.load = a.store = a.exclusive = 1;
   }
-  // A4-52 & A4-202 LDREX/STREXX
-  else if(bits_get(instruction, 21, 27) == 0b0001100) {
-    // Only words
-    for(int i = 0; i < 4; i++)
-      set_insert(destination_set, addr + i);
+  // A4-52 & A4-202 LDREX/STREX, plus the byte/halfword/double variants
+  else if((instruction & 0x0f8000f0) == 0x01800090) {
+    static const uint8_t size[4] = { 4, 8, 1, 2 };
+    a.kind = MEM_EXCLUSIVE;
+    a.n_bytes = size[bits_get(instruction, 21, 22)];
+    a.load = l;
+    a.store = !l;
+    a.exclusive = 1;
   }
-  // A3-22 : Load/store word or unsigned byte
+  // A3-22 : Load/store word or unsigned byte. With I set, bit 4 means a
+  // media instruction instead.
   else if(bits_get(instruction, 26, 27) == 0b01) {
+    if(bit_isset(instruction, 25) && bit_isset(instruction, 4))
+      return a;
     // A3-22 : B == 1 means byte
-    if(bit_isset(instruction, 22)) {
-      set_insert(destination_set, addr);
-    } else {
-      for(int i = 0; i < 4; i++)
-        set_insert(destination_set, addr + i);
-    }
+    a.kind = MEM_WORD_BYTE;
+    a.n_bytes = bit_isset(instruction, 22) ? 1 : 4;
+    a.load = l;
+    a.store = !l;
   }
-  // A3-23 : Load/store halfword, double word, or signed byte
-  else if(bits_get(instruction, 25, 27) == 0b000) {
+  // A3-23 : Load/store halfword, double word, or signed byte. SH == 0 is
+  // multiply/swap space.
+  else if(bits_get(instruction, 25, 27) == 0b000
+       && bit_isset(instruction, 7) && bit_isset(instruction, 4)
+       && bits_get(instruction, 5, 6) != 0) {
     // Ugh
-    uint32_t l = bit_isset(instruction, 20);
     uint32_t sh = bits_get(instruction, 5, 6);
     uint32_t lsh = (l << 2) | sh;
+    a.kind = MEM_MISC;
     // A5-34
     switch(lsh) {
       // Store halfword
       case 0b001:
+        a.n_bytes = 2;
+        a.store = 1;
+        break;
       // Load signed half word
       case 0b111:
       // Load unsigned halfword
       case 0b101:
-        set_insert(destination_set, addr);
-        set_insert(destination_set, addr + 1);
+        a.n_bytes = 2;
+        a.load = 1;
         break;
       // Load double word
       case 0b010:
+        a.n_bytes = 8;
+        a.load = 1;
+        break;
       // Store double word
       case 0b011:
-        for(int i = 0; i < 8; i++)
-          set_insert(destination_set, addr + i);
+        a.n_bytes = 8;
+        a.store = 1;
         break;
       // Load signed byte
       case 0b110:
-        set_insert(destination_set, addr);
+        a.n_bytes = 1;
+        a.load = 1;
         break;
-      default:
-        printk("%x accessed %x\n", instruction, addr);
-        panic("Unexpected LSH combination\n");
     }
   }
   // A3-26 : Load/store multiple
   else if(bits_get(instruction, 25, 27) == 0b100) {
-    // Weakness - assumes that the LDM/STM traps for ALL accessed data, not
-    // only some of the accesses
     uint32_t register_list = bits_get(instruction, 0, 15);
-    uint32_t offset = 0;
-    for(int i = 0; i < 16; i++) {
-      if((register_list >> i) & 0x1) {
-        for(int j = 0; j < 4; j++)
-          set_insert(destination_set, addr + offset + j);
-        offset += 4;
-      }
-    }
+    a.kind = MEM_MULTIPLE;
+    for(int i = 0; i < 16; i++)
+      if((register_list >> i) & 0x1)
+        a.n_bytes += 4;
+    a.load = l;
+    a.store = !l;
+  }
+
+  return a;
+}
+
+typedef struct {
+  uint32_t pc;
+  mem_access_t a;
+} decode_entry_t;
+
+// An unaligned pc never matches, so that marks empty entries
+static decode_entry_t decode_cache[1 << RW_DECODE_CACHE_LOG2] = {
+  [0 ... (1 << RW_DECODE_CACHE_LOG2) - 1] = { .pc = 1 }
+};
+
+mem_access_t mem_access_at(uint32_t pc) {
+  decode_entry_t* e = &decode_cache[(pc >> 2) & ((1 << RW_DECODE_CACHE_LOG2) - 1)];
+  if(e->pc != pc) {
+    PERF_EVENT(DECODE_MISS);
+    e->pc = pc;
+    e->a = mem_access_decode(GET32(pc));
+  }
+  return e->a;
+}
+
+static void get_touched_bytes(uint32_t pc, uint32_t addr, set_t* destination_set) {
+  // TODO: Alignment?????
+  mem_access_t a = mem_access_at(pc);
+  if(!a.n_bytes) {
+    printk("%x accessed %x\n", GET32(pc), addr);
+    equiv_panic("Unexpected load/store encoding\n");
   }
 
-  
+  // Weakness - assumes that the LDM/STM traps for ALL accessed data, not
+  // only some of the accesses
+  for(uint32_t i = 0; i < a.n_bytes; i++)
+    set_insert(destination_set, addr + i);
 }
 
 
@@ -97,6 +146,8 @@ void set_memory_touch_handler(memory_touch_handler_t func) {
 } 
 
 static void rw_tracker_data_abort_handler(regs_t* r) {
+  PERF_EVENT(DATA_ABORT);
+  PERF_START(DATA_ABORT);
   uint32_t addr = cp15_far_get();
   uint32_t pc = r->regs[REGS_PC];
   uint32_t dfsr = cp15_dfsr_get();
@@ -113,11 +164,10 @@ static void rw_tracker_data_abort_handler(regs_t* r) {
 
   // Compute set of touched bytes
   set_t* touched = set_alloc();
-  uint32_t instruction = GET32(pc);
-  get_touched_bytes(instruction, addr, touched);
+  get_touched_bytes(pc, addr, touched);
 
   if (memory_touch_handler) {
-    memory_touch_handler(touched, pc); 
+    memory_touch_handler(touched, pc, w);
   }
 
   // Store R/W addresses
@@ -126,9 +176,33 @@ static void rw_tracker_data_abort_handler(regs_t* r) {
   else if(current_tracker.read && !w)
     set_union_inplace(current_tracker.read, touched);
 
+  // Store PCs that access shared memory
+  if(current_tracker.shared_memory && current_tracker.flagged_pcs) {
+    set_t* shared = set_alloc();
+    set_intersection(shared, current_tracker.shared_memory, touched);
+    if(!set_empty(shared)) {
+      set_insert(current_tracker.flagged_pcs, pc);
+      current_tracker.n_flagged++;
+    }
+    set_free(shared);
+  }
+
+  set_free(touched);
+
+  // Do the access here and resume past it, still armed
+  if(EQUIV_MERGED_TRAPS) {
+    if(!mem_emulate(r)) {
+      printk("%x at %x accessed %x\n", GET32(pc), pc, addr);
+      equiv_panic("Can't emulate load/store\n");
+    }
+    PERF_STOP(DATA_ABORT);
+    equiv_after_access(r);
+    return;
+  }
+
   // Disable data aborts
   rw_tracker_disarm();
-  set_free(touched);
+  PERF_STOP(DATA_ABORT);
 }
 
 void rw_tracker_init(uint32_t enabled) {
@@ -142,6 +216,8 @@ void rw_tracker_enable() {
   rw_tracker_enabled = 1;
 }
 void rw_tracker_disable() {
+  // The fast step path would arm it again
+  step_fast_stop();
   rw_tracker_disarm();
   rw_tracker_enabled = 0;
 }
@@ -156,10 +232,24 @@ void set_data_faults(uint32_t enable) {
   if(enable) domain_acl = bits_set(domain_acl, user_dom, user_dom+1, DOM_client);
   else       domain_acl = bits_set(domain_acl, user_dom, user_dom+1, DOM_manager);
   domain_access_ctrl_set(domain_acl);
+  // Whether data faults are on, so arming twice doesn't rewrite the DACR.
+  // The prefetch fast path arms too, so the flag lives in step_fast.
+  step_fast.faults_on = enable;
+  PERF_EVENT(DACR_TOGGLE);
 }
 
 // Only arms if enabled
-void rw_tracker_arm() { if(rw_tracker_enabled) set_data_faults(1); }
+void rw_tracker_arm() { if(rw_tracker_enabled && !step_fast.faults_on) set_data_faults(1); }
+
+uint32_t rw_tracker_armed_dacr(void) {
+  if(!rw_tracker_enabled) return 0;
+  return bits_set(domain_access_ctrl_get(), user_dom, user_dom+1, DOM_client);
+}
+
+void rw_tracker_arm_at(uint32_t pc) {
+  if(rw_tracker_enabled && !step_fast.faults_on && user_scan_may_access(pc))
+    set_data_faults(1);
+}
 
 // Always disarms
 void rw_tracker_disarm() { set_data_faults(0); }
@@ -185,9 +275,10 @@ void find_rw_set(func_ptr exe, set_t* read, set_t* write) {
   // Clean up
   rw_tracker_disable();
   reset_ntids();
+  current_tracker = rw_tracker_mk(NULL, NULL);
 }
 
-void find_pc_set(func_ptr exe, set_t* shared_memory, set_t* pcs) {
+uint32_t find_pc_set(func_ptr exe, set_t* shared_memory, set_t* pcs) {
   // Initialize single stepping & threads
   equiv_init();
 
@@ -206,8 +297,8 @@ void find_pc_set(func_ptr exe, set_t* shared_memory, set_t* pcs) {
   // Clean up
   rw_tracker_disable();
   reset_ntids();
-}
-
 
-
-// Finds
+  uint32_t n = current_tracker.n_flagged;
+  current_tracker = pc_tracker_mk(NULL, NULL);
+  return n;
+}
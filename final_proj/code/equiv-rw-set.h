@@ -12,6 +12,8 @@ typedef struct {
   // If both defined, accesses to shared memory are stored in flagged_pcs
   set_t* shared_memory;
   set_t* flagged_pcs;
+  // Number of accesses to shared memory
+  uint32_t n_flagged;
 } rw_tracker_t;
 
 /*
@@ -19,9 +21,61 @@ typedef struct {
  */
 
 /*
- * Install handler to be called on every memory touch event
+ * Build with -DEQUIV_MERGED_TRAPS=1 to emulate every tracked access in the
+ * data abort (see mem-emulate.h) instead of letting it re-execute. The
+ * tracker then never has to be re-armed and the schedule's counting happens
+ * in the same trap, so threads run without single-stepping: a shared access
+ * costs one trap and everything else none.
  */
-typedef void (*memory_touch_handler_t)(set_t* touched_memory, uint32_t pc); 
+#ifndef EQUIV_MERGED_TRAPS
+#define EQUIV_MERGED_TRAPS 0
+#endif
+
+// Encoding class of a load/store
+enum {
+  MEM_NONE = 0,
+  MEM_SWAP,         // A4-213 SWP/SWPB
+  MEM_EXCLUSIVE,    // A4-52 LDREX/STREX and forms
+  MEM_WORD_BYTE,    // A3-22
+  MEM_MISC,         // A3-23 halfword, double word, signed byte
+  MEM_MULTIPLE,     // A3-26 LDM/STM
+};
+
+/*
+ * The memory access an instruction makes. n_bytes is 0 if it doesn't
+ * access memory.
+ */
+typedef struct {
+  uint8_t kind;
+  uint8_t n_bytes;
+  uint8_t load;
+  uint8_t store;
+  // LDREX/STREX/SWP and their byte/halfword/double forms
+  uint8_t exclusive;
+} mem_access_t;
+
+/*
+ * Decodes a load/store (A3-22, A3-23, A3-26, A4-52, A4-202, A4-213). Used both
+ * for faulting accesses and for scanning code that hasn't run yet.
+ */
+mem_access_t mem_access_decode(uint32_t instruction);
+
+// Decode cache size, direct mapped by PC
+#ifndef RW_DECODE_CACHE_LOG2
+#define RW_DECODE_CACHE_LOG2 6
+#endif
+
+/*
+ * mem_access_decode of the instruction at pc, from a cache filled on first
+ * use. Code doesn't change after boot, so entries are never invalidated.
+ */
+mem_access_t mem_access_at(uint32_t pc);
+
+/*
+ * Install handler to be called on every memory touch event. w is set for
+ * writes.
+ */
+typedef void (*memory_touch_handler_t)(set_t* touched_memory, uint32_t pc, uint32_t w);
 void set_memory_touch_handler(memory_touch_handler_t func);
 
 /*
@@ -34,7 +88,8 @@ static rw_tracker_t rw_tracker_mk(set_t* r, set_t* w) {
     .read = r,
     .write = w,
     .shared_memory = NULL,
-    .flagged_pcs = NULL
+    .flagged_pcs = NULL,
+    .n_flagged = 0
   };
   return t;
 }
@@ -44,7 +99,8 @@ static rw_tracker_t pc_tracker_mk(set_t* shared_mem, set_t* pcs) {
     .read = NULL,
     .write = NULL,
     .shared_memory = shared_mem,
-    .flagged_pcs = pcs
+    .flagged_pcs = pcs,
+    .n_flagged = 0
   };
   return t;
 }
@@ -64,6 +120,19 @@ void rw_tracker_disable();
 void rw_tracker_arm();
 void rw_tracker_disarm();
 
+/*
+ * Arms only if the instruction at pc can access memory (see user-scan.h).
+ * The tracker stays armed until an access faults, so single steps over
+ * everything else don't touch the DACR.
+ */
+void rw_tracker_arm_at(uint32_t pc);
+
+/*
+ * DACR value with data faults on, for the fast step path to load. 0 if the
+ * tracker is disabled.
+ */
+uint32_t rw_tracker_armed_dacr(void);
+
 /*
  * Record a syscall. Used to also track locks and other synchronization primitives.
  */
@@ -81,8 +150,9 @@ void set_tracker(rw_tracker_t tracker);
 void find_rw_set(func_ptr exe, set_t* read, set_t* write);
 
 /*
- * Finds the set of PCs that access shared memory
+ * Finds the set of PCs that access shared memory. Returns the number of
+ * accesses to shared memory
  */
-void find_pc_set(func_ptr exe, set_t* shared_memory, set_t* pcs);
+uint32_t find_pc_set(func_ptr exe, set_t* shared_memory, set_t* pcs);
 
 #endif
@@ -5,10 +5,15 @@
 #include "fast-hash32.h"
 #include "equiv-mmu.h"
 #include "equiv-rw-set.h"
+#include "equiv-uart.h"
+#include "equiv-perf.h"
+#include "mem-emulate.h"
+#include "memory.h"
+#define XXH_INLINE_ALL 1
+#include "xxhash.h"
 
-enum { stack_size = 1024 * 2 };
-_Static_assert(stack_size > 1024, "too small");
-_Static_assert(stack_size % 8 == 0, "not aligned");
+_Static_assert(EQUIV_STACK_SIZE > 1024, "too small");
+_Static_assert(EQUIV_STACK_SIZE % 8 == 0, "not aligned");
 
 typedef struct rq {
     eq_th_t *head, *tail;
@@ -18,12 +23,20 @@ typedef struct rq {
 gen_queue_T(eq, rq_t, head, tail, eq_th_t, next)
 
 static rq_t equiv_runq;
+
+// Pool entries not in use, taken from the head and returned to the tail
+static rq_t equiv_free;
+static eq_th_t *equiv_pool;
+// Thread of each tid handed out since the last reset_ntids
+static eq_th_t *equiv_live[EQUIV_MAX_THREADS];
 static eq_th_t * volatile cur_thread;
 static regs_t start_regs;
 
 static ctx_switch_status_t ctx_switch_status;
 static set_t* shared_memory = NULL;
+static set_t** switch_points = NULL;
 static schedule_t* schedule = NULL;
+static bitstate_t* visited = NULL;
 
 static uint32_t init = 0;
 
@@ -61,12 +74,74 @@ eq_th_t * retrieve_tid_from_queue(uint32_t tid) {
         // printk("#1 append tid %d\n", old_thread->tid);
         eq_append(&equiv_runq, old_thread);
         if(th->tid == first_tid) {
-            panic("specified tid %d is not in the queue\n", tid);
+            equiv_panic("specified tid %d is not in the queue\n", tid);
         }
     }
     return th;
 }
 
+// A blocked thread becomes runnable again once its word changes
+static int equiv_runnable(eq_th_t *th) {
+    if(!th->blocked_on)
+        return 1;
+    if(GET32(th->blocked_on) == th->blocked_val)
+        return 0;
+    th->blocked_on = 0;
+    return 1;
+}
+
+// Pops the first runnable thread, leaving the others in order. Returns NULL
+// if the queue is empty or every thread in it is blocked.
+static eq_th_t *eq_pop_runnable(void) {
+    eq_th_t *first = NULL;
+    eq_th_t *th;
+    while((th = eq_pop(&equiv_runq)) && th != first) {
+        if(equiv_runnable(th))
+            return th;
+        if(!first)
+            first = th;
+        eq_append(&equiv_runq, th);
+    }
+    if(th)
+        eq_push(&equiv_runq, th);
+    return NULL;
+}
+
+// Runs th. Its first instruction executes before the next single-step fault,
+// so the tracker has to be armed for it here. Without stepping it simply
+// stays armed.
+static __attribute__((noreturn))
+void equiv_resume(eq_th_t *th) {
+    if(EQUIV_MERGED_TRAPS) {
+        // A switch ends any exclusive access, like a CLREX would
+        mem_emulate_clrex();
+        rw_tracker_arm();
+        switchto(&th->regs);
+    }
+    rw_tracker_arm_at(th->regs.regs[REGS_PC]);
+    mismatch_run(&th->regs);
+}
+
+// Ends the run, dropping the threads that are left so the next run starts
+// clean
+static __attribute__((noreturn))
+void equiv_abort_run(void) {
+    schedule = NULL;
+    while(eq_pop(&equiv_runq))
+        ;
+    switchto(&start_regs);
+    not_reached();
+}
+
+// Every unfinished thread is blocked: end the run
+static __attribute__((noreturn))
+void equiv_deadlock(void) {
+    ctx_switch_status.deadlock = 1;
+    if(verbose_p)
+        trace("all threads are blocked\n");
+    equiv_abort_run();
+}
+
 static __attribute__((noreturn)) 
 void equiv_schedule(void) 
 {
@@ -81,12 +156,12 @@ void equiv_schedule(void)
       schedule &&
       ctx_switch_status.ctx_switch < schedule->n_ctx_switches
     ) {
-      panic("BAD");
+      equiv_panic("BAD");
         uint32_t tid_idx = ctx_switch_status.ctx_switch + 1;
         th = retrieve_tid_from_queue(schedule->tids[tid_idx]);
     }
     else{
-        th = eq_pop(&equiv_runq);
+        th = eq_pop_runnable();
     }
     
     if(th) {
@@ -100,8 +175,7 @@ void equiv_schedule(void)
         eq_append(&equiv_runq, cur_thread);
         cur_thread = th;
     }
-    uart_flush_tx();
-    mismatch_run(&cur_thread->regs);
+    equiv_resume(cur_thread);
 }
 
 void print_schedule(const char* msg, schedule_t* schedule) {
@@ -117,7 +191,7 @@ void print_schedule(const char* msg, schedule_t* schedule) {
       for(int f = 0; f < schedule->n_funcs; f++) {
         printk("\t");
         if(schedule->tids[ctx_switch]-1 == f) {
-          if(schedule->report) {
+          if(schedule->report && instr < schedule->report->n_pcs[ctx_switch]) {
             printk("%x", schedule->report->pcs[ctx_switch][instr]);
           } else {
             printk("|");
@@ -142,30 +216,67 @@ void print_schedule(const char* msg, schedule_t* schedule) {
   printk("\n");
 }
 
-void ctx_switch_handler(set_t *touched_memory, uint32_t pc) {
+void ctx_switch_handler(set_t *touched_memory, uint32_t pc, uint32_t w) {
     // If we don't have a schedule, give up
     if(!schedule) return;
+    PERF_START(CTX_SWITCH);
+
+    // If we are out of context switches, run to completion. The report still
+    // wants the first switch point hit after the last switch.
+    uint32_t n_switches = schedule->n_ctx_switches;
+    uint32_t in_tail = ctx_switch_status.ctx_switch >= n_switches;
+    uint32_t count_tail = in_tail && schedule->count_tail &&
+      !ctx_switch_status.tail_blocked && cur_thread->tid == schedule->tids[n_switches];
+    if(in_tail && !count_tail &&
+       !(schedule->report && n_switches && !schedule->report->after_pcs[n_switches-1])) {
+      PERF_STOP(CTX_SWITCH);
+      return;
+    }
 
-    // If we are out of context switches, run to completion
-    if(ctx_switch_status.ctx_switch >= schedule->n_ctx_switches) return;
+    // only count accesses that can race with another thread
+    set_t *sp = shared_memory;
+    if(switch_points)
+      sp = switch_points[cur_thread->tid - 1];
 
-    // find intersection of shared memory and touched memory
+    // find intersection of switch points and touched memory
     set_t *intersection = set_alloc();
-    set_intersection(intersection, shared_memory, touched_memory);
+    set_intersection(intersection, sp, touched_memory);
 
     // if the intersection is non-empty
     if (!set_empty(intersection)) {
         if(cur_thread->verbose_p)
           trace("PC %x touched shared memory\n", pc);
         if(schedule->report) {
-          schedule->report->pcs[ctx_switch_status.ctx_switch][ctx_switch_status.instr_count] = pc;
+          let report = schedule->report;
+          // First switch point after a switch
+          if(ctx_switch_status.ctx_switch > 0 && ctx_switch_status.instr_count == 0 &&
+             !report->after_pcs[ctx_switch_status.ctx_switch - 1])
+            report->after_pcs[ctx_switch_status.ctx_switch - 1] = pc;
+          if(!in_tail) {
+            report->pcs[ctx_switch_status.ctx_switch][ctx_switch_status.instr_count] = pc;
+            report->n_pcs[ctx_switch_status.ctx_switch] = ctx_switch_status.instr_count + 1;
+          }
+        }
+        if(count_tail)
+          ctx_switch_status.tail_count++;
+        if(!in_tail) {
+          ctx_switch_status.do_instr_count = 1;
+          // The next step has to count
+          step_fast_stop();
         }
-        ctx_switch_status.do_instr_count = 1;
     }
     set_free(intersection);
+    PERF_STOP(CTX_SWITCH);
 }
 
+uint32_t equiv_cur_tid(void) {
+    return cur_thread ? cur_thread->tid : 0;
+}
 
+void equiv_cur_stack(uint32_t *start, uint32_t *end) {
+    *start = cur_thread ? cur_thread->stack_start : 0;
+    *end = cur_thread ? cur_thread->stack_end : 0;
+}
 
 /******************************************************************
  * tiny syscall setup.
@@ -185,16 +296,72 @@ void set_schedule(schedule_t* s) { schedule = s; }
 
 void set_shared_memory(set_t* sh) { shared_memory = sh; }
 
+void set_switch_points(set_t** sp) { switch_points = sp; }
+
+void set_visited_states(bitstate_t* b) { visited = b; }
+
+// Whether the run is the first of the schedules below the current switch,
+// i.e. every later instruction count is still 1
+static int switch_subtree_root(void) {
+    for(uint32_t i = ctx_switch_status.ctx_switch; i < schedule->n_ctx_switches; i++)
+        if(schedule->instr_counts[i] != 1)
+            return 0;
+    return 1;
+}
+
+// Hash of everything the rest of the schedule depends on: the switch, the
+// threads still to run, every live thread's registers, stack and blocked
+// word, and shared memory. Memory that is neither shared nor on a thread
+// stack is left out.
+static uint64_t equiv_state_hash(void) {
+    XXH64_state_t state;
+    XXH64_reset(&state, 0);
+
+    uint32_t k = ctx_switch_status.ctx_switch;
+    uint32_t ncs = schedule->n_ctx_switches;
+    XXH64_update(&state, &k, sizeof(k));
+    XXH64_update(&state, &ncs, sizeof(ncs));
+    XXH64_update(&state, &schedule->tids[k], (ncs - k + 1) * sizeof(uint32_t));
+
+    // In tid order, the run queue order depends on the path taken
+    eq_th_t *by_tid[EQUIV_MAX_THREADS] = { 0 };
+    by_tid[cur_thread->tid - 1] = cur_thread;
+    for(eq_th_t *th = equiv_runq.head; th; th = th->next)
+        by_tid[th->tid - 1] = th;
+
+    for(uint32_t i = 0; i < schedule->n_funcs; i++) {
+        eq_th_t *th = by_tid[i];
+        if(!th) continue;
+        XXH64_update(&state, &th->tid, sizeof(th->tid));
+        XXH64_update(&state, &th->regs, sizeof(regs_t));
+        XXH64_update(&state, &th->blocked_on, sizeof(th->blocked_on));
+        XXH64_update(&state, &th->blocked_val, sizeof(th->blocked_val));
+        uint32_t sp = th->regs.regs[REGS_SP];
+        if(sp >= th->stack_start && sp < th->stack_end)
+            XXH64_update(&state, (void*)sp, th->stack_end - sp);
+    }
+
+    uint64_t mem = hash_mem64(shared_memory);
+    XXH64_update(&state, &mem, sizeof(mem));
+    return XXH64_digest(&state);
+}
+
 void reset_ctx_switch() {
   ctx_switch_status.instr_count = 0;
   ctx_switch_status.ctx_switch = 0;
   ctx_switch_status.do_instr_count = 0;
   ctx_switch_status.yielded = 0;
+  ctx_switch_status.stuck = 0;
+  ctx_switch_status.deadlock = 0;
+  ctx_switch_status.pruned = 0;
+  ctx_switch_status.tail_count = 0;
+  ctx_switch_status.tail_blocked = 0;
 }
 
-void enable_ctx_switch(schedule_t* sched, set_t* shared_mem) {
+void enable_ctx_switch(schedule_t* sched, set_t* shared_mem, set_t** sp) {
   schedule = sched;
   shared_memory = shared_mem;
+  switch_points = sp;
   reset_ctx_switch();
 }
 
@@ -203,6 +370,7 @@ ctx_switch_status_t get_ctx_switch_status() { return ctx_switch_status; }
 void disable_ctx_switch(){
     schedule = NULL;
     shared_memory = NULL;
+    switch_points = NULL;
     reset_ctx_switch();
 }
 
@@ -216,36 +384,87 @@ void sys_equiv_switch(uint32_t ret);
 static void check_sp(eq_th_t *th) {
     let sp = th->regs.regs[REGS_SP];
     if(sp < th->stack_start)
-        panic("stack is too small: %x, lowest legal=%x\n",
+        equiv_panic("stack is too small: %x, lowest legal=%x\n",
             sp, th->stack_start);
     if(sp > th->stack_end)
-        panic("stack is too high: %x, highest legal=%x\n",
+        equiv_panic("stack is too high: %x, highest legal=%x\n",
             sp, th->stack_end);
 }
 
-// our two system calls: exit (get the next thread if there is one)
-// and putc (so we can handle race conditions with prints)
+// The schedule wants a thread that is blocked. Following it would only spin,
+// so it is abandoned and everything runs to completion.
+static void equiv_stuck(eq_th_t *th) {
+    if(th->verbose_p)
+        trace("Thread %d is blocked, abandoning schedule\n", th->tid);
+    eq_push(&equiv_runq, th);
+    ctx_switch_status.stuck = 1;
+    schedule = NULL;
+}
+
+// cur_thread just blocked and is back on the run queue. Under a schedule the
+// block ends its slot early and the next thread in the schedule runs, without
+// using up an extra context switch.
+static __attribute__((noreturn))
+void equiv_switch_blocked(void) {
+    eq_th_t *th = NULL;
+
+    if(schedule && ctx_switch_status.ctx_switch < schedule->n_ctx_switches) {
+        uint32_t slot = ctx_switch_status.ctx_switch;
+        ctx_switch_status.ctx_switch++;
+        ctx_switch_status.instr_count = 0;
+        ctx_switch_status.do_instr_count = 0;
+        PERF_EVENT(SWITCH);
+
+        th = retrieve_tid_from_queue(schedule->tids[slot + 1]);
+        if(!equiv_runnable(th)) {
+            equiv_stuck(th);
+            th = NULL;
+        }
+    } else if(schedule && cur_thread->tid == schedule->tids[schedule->n_ctx_switches])
+        ctx_switch_status.tail_blocked = 1;
+    if(!th)
+        th = eq_pop_runnable();
+    if(!th)
+        equiv_deadlock();
+
+    if(th->verbose_p)
+        trace("switching from blocked tid=%d,pc=%x to tid=%d,pc=%x,sp=%x\n", 
+            cur_thread->tid, 
+            cur_thread->regs.regs[REGS_PC],
+            th->tid,
+            th->regs.regs[REGS_PC],
+            th->regs.regs[REGS_SP]);
+
+    cur_thread = th;
+    equiv_resume(cur_thread);
+    not_reached();
+}
+
+// our system calls: exit (get the next thread if there is one), putc (so we
+// can handle race conditions with prints), yield and block
 static int equiv_syscall_handler(regs_t *r) {
     let th = cur_thread;
     assert(th);
     th->regs = *r;  // update the registers
 
-    uart_flush_tx();
     check_sp(th);
 
     unsigned sysno = r->regs[0];
     switch(sysno) {
     case EQUIV_PUTC: 
-        uart_put8(r->regs[1]);
+        equiv_uart_put8(r->regs[1]);
         break;
     case EQUIV_YIELD:
+        PERF_EVENT(YIELD);
         schedule = NULL;
         ctx_switch_status.yielded = 1;
         if(th->verbose_p)
           trace("Thread %d yielded, running all to completion\n", th->tid);
         
         eq_append(&equiv_runq, cur_thread);
-        th = eq_pop(&equiv_runq);
+        th = eq_pop_runnable();
+        if(!th)
+            equiv_deadlock();
         
         if(th->verbose_p)
           trace("switching from tid=%d,pc=%x to tid=%d,pc=%x,sp=%x\n", 
@@ -256,9 +475,23 @@ static int equiv_syscall_handler(regs_t *r) {
               th->regs.regs[REGS_SP]);
 
         cur_thread = th;
-        mismatch_run(&cur_thread->regs);
+        equiv_resume(cur_thread);
         not_reached();
         break;
+    case EQUIV_BLOCK:
+        // Already woken up, keep running
+        if(GET32(r->regs[1]) != r->regs[2])
+            equiv_resume(th);
+
+        PERF_EVENT(BLOCK);
+        th->blocked_on = r->regs[1];
+        th->blocked_val = r->regs[2];
+        if(th->verbose_p)
+          trace("Thread %d blocked on %x\n", th->tid, th->blocked_on);
+
+        eq_append(&equiv_runq, th);
+        equiv_switch_blocked();
+        not_reached();
     case EQUIV_EXIT: 
         if(schedule) {
           // Run to completion. Disable traps
@@ -273,7 +506,9 @@ static int equiv_syscall_handler(regs_t *r) {
             schedule = NULL;
           }
         }
-        th = eq_pop(&equiv_runq);
+        th = eq_pop_runnable();
+        if(!th && !eq_empty(&equiv_runq))
+            equiv_deadlock();
         
         if(th && th->verbose_p)
           trace("thread %d next\n", th->tid);
@@ -285,7 +520,7 @@ static int equiv_syscall_handler(regs_t *r) {
         }
         // otherwise do the next one.
         cur_thread = th;
-        mismatch_run(&cur_thread->regs);
+        equiv_resume(cur_thread);
         not_reached();
 
     // case EQUIV_SWITCH:
@@ -293,7 +528,7 @@ static int equiv_syscall_handler(regs_t *r) {
     //         th->tid, r->regs[1], th->reg_hash);
 
     default:
-        panic("illegal system call: %d\n", sysno);
+        equiv_panic("illegal system call: %d\n", sysno);
     }
 
     equiv_schedule();
@@ -319,23 +554,53 @@ static unsigned ntids = 1;
 
 void reset_ntids() {
   assert(eq_empty(&equiv_runq));
+  for(unsigned i = 0; i < ntids - 1; i++) {
+    eq_append(&equiv_free, equiv_live[i]);
+    equiv_live[i] = NULL;
+  }
   ntids = 1;
 }
 
+// Takes the least recently released pool entry, growing its stack if it is
+// smaller than stack_size
+static eq_th_t *equiv_acquire(uint32_t stack_size) {
+    if(!equiv_pool) {
+        equiv_pool = kmalloc(sizeof(eq_th_t) * EQUIV_MAX_THREADS);
+        memset(equiv_pool, 0, sizeof(eq_th_t) * EQUIV_MAX_THREADS);
+        for(unsigned i = 0; i < EQUIV_MAX_THREADS; i++)
+            eq_append(&equiv_free, &equiv_pool[i]);
+    }
+
+    eq_th_t *th = eq_pop(&equiv_free);
+    if(!th)
+        equiv_panic("more than %d threads\n", EQUIV_MAX_THREADS);
+    if(th->pool_stack_size < stack_size) {
+        th->pool_stack = (uint32_t)kmalloc_aligned(stack_size, 8);
+        th->pool_stack_size = stack_size;
+    }
+    return th;
+}
+
 // fork <fn(arg)> as a pre-emptive thread.
 eq_th_t *equiv_fork(void (*fn)(void**), void **args, uint32_t expected_hash) {
-    eq_th_t *th = kmalloc_aligned(stack_size, 8);
+    return equiv_fork_stack(fn, args, EQUIV_STACK_SIZE);
+}
+
+eq_th_t *equiv_fork_stack(void (*fn)(void**), void **args, uint32_t stack_size) {
+    demand(stack_size % 8 == 0, stack size must keep sp aligned);
+    eq_th_t *th = equiv_acquire(stack_size);
 
-    assert((uint32_t)th%8==0);
     th->tid = ntids++;
+    equiv_live[th->tid - 1] = th;
+    th->blocked_on = 0;
 
     th->verbose_p = verbose_p;
 
     th->fn = (uint32_t)fn;
     th->args = (uint32_t)args;
 
-    // allocate the 8byte aligned stack
-    th->stack_start = (uint32_t)th;
+    // the 8byte aligned stack
+    th->stack_start = th->pool_stack;
     th->stack_end = th->stack_start + stack_size;
     demand(th->stack_end % 8 == 0, sp is not aligned);
     
@@ -357,18 +622,15 @@ eq_th_t *equiv_fork_nostack(void (*fn)(void**), void **args, uint32_t expected_h
 // re-initialize and put back on the run queue
 void equiv_refresh(eq_th_t *th) {
     th->regs = equiv_regs_init(th); 
+    th->blocked_on = 0;
     check_sp(th);
     eq_push(&equiv_runq, th);
 }
 
 
-// just print out the pc and instruction count.
-static void equiv_hash_handler(void *data, step_fault_t *s) {
-    rw_tracker_arm();
-
-    // Update the current thread's register data
-    memcpy(&cur_thread->regs, s->regs, sizeof(regs_t));
-
+// A shared access finished on cur_thread: count it, and switch if that was
+// the last one of the current slot. cur_thread->regs must be up to date.
+static void equiv_count_access(void) {
     if(ctx_switch_status.do_instr_count) {
       ctx_switch_status.do_instr_count = 0;
       // increment 
@@ -388,11 +650,25 @@ static void equiv_hash_handler(void *data, step_fault_t *s) {
 
           ctx_switch_status.ctx_switch++;
           ctx_switch_status.instr_count = 0;
+          PERF_EVENT(SWITCH);
+
+          // Every schedule below this switch was run from the same state
+          if(visited && switch_subtree_root() &&
+             bitstate_test_and_set(visited, equiv_state_hash())) {
+            if(cur_thread->verbose_p)
+              trace("State at switch %d visited before\n", ctx_switch_status.ctx_switch);
+            ctx_switch_status.pruned = 1;
+            equiv_abort_run();
+          }
 
           // context switch
           // equiv_schedule();
           uint32_t tid_idx = ctx_switch_status.ctx_switch;
           eq_th_t* th = retrieve_tid_from_queue(schedule->tids[tid_idx]);
+          if(!equiv_runnable(th)) {
+            equiv_stuck(th);
+            return;
+          }
           eq_append(&equiv_runq, cur_thread);
           
           if(th->verbose_p)
@@ -404,12 +680,33 @@ static void equiv_hash_handler(void *data, step_fault_t *s) {
                 th->regs.regs[REGS_SP]);
 
           cur_thread = th;
-          uart_flush_tx();
-          mismatch_run(&cur_thread->regs);
+          equiv_resume(cur_thread);
       }
     }
 }
 
+// just print out the pc and instruction count.
+static void equiv_hash_handler(void *data, step_fault_t *s) {
+    rw_tracker_arm_at(s->regs->regs[REGS_PC]);
+
+    // Update the current thread's register data
+    memcpy(&cur_thread->regs, s->regs, sizeof(regs_t));
+
+    equiv_count_access();
+
+    // Until a shared access asks for a count the steps only need the
+    // mismatch moved and the tracker re-armed, which the fast vector does
+    if(!ctx_switch_status.do_instr_count)
+        step_fast_allow(rw_tracker_armed_dacr());
+}
+
+void equiv_after_access(regs_t *r) {
+    if(!ctx_switch_status.do_instr_count)
+        return;
+    memcpy(&cur_thread->regs, r, sizeof(regs_t));
+    equiv_count_access();
+}
+
 // run all the threads.
 void equiv_run(void) {
     // printk("starting equiv_run\n");
@@ -424,13 +721,24 @@ void equiv_run(void) {
     // printk("starting thread %d\n", cur_thread->tid);
     
     if(!cur_thread)
-        panic("empty run queue?\n");
+        equiv_panic("empty run queue?\n");
 
     // this is roughly the same as in mini-step.c
-    mismatch_on();
-    mismatch_pc_set(0);
-    switchto_cswitch(&start_regs, &cur_thread->regs);
-    mismatch_off();
+    equiv_uart_buffer_on();
+    if(EQUIV_MERGED_TRAPS) {
+        // Every tracked access is emulated by the data abort, which does
+        // the counting, so there is nothing to step
+        mem_emulate_clrex();
+        rw_tracker_arm();
+        switchto_cswitch(&start_regs, &cur_thread->regs);
+    } else {
+        mismatch_on();
+        mismatch_pc_set(0);
+        switchto_cswitch(&start_regs, &cur_thread->regs);
+        mismatch_off();
+    }
+    // no thread is stepping, safe to write out the run's output
+    equiv_uart_buffer_off();
     //trace("done, returning\n");
 
     // reset the context switch index
@@ -442,6 +750,7 @@ void equiv_run(void) {
 void equiv_init(void) {
     if(init)
         return;
+    equiv_uart_init();
     mini_step_init(equiv_hash_handler, 0); 
     full_except_set_syscall(equiv_syscall_handler); 
 }
@@ -6,9 +6,27 @@
  */
 #include "switchto.h"
 #include "set.h"
+#include "bitstate.h"
+
+// Threads in the pool: the most any phase has live at once
+#ifndef EQUIV_MAX_THREADS
+#define EQUIV_MAX_THREADS 32
+#endif
+
+// Default stack size of a forked thread
+#ifndef EQUIV_STACK_SIZE
+#define EQUIV_STACK_SIZE (1024 * 2)
+#endif
 
 typedef struct {
+  // pcs[i][j] is the PC of the j-th switch point hit before switch i
   uint32_t** pcs;
+  // n_pcs[i] is how many of pcs[i] were hit. A slot that ends early because
+  // its thread blocked, or that a schedule never reached, has fewer than
+  // instr_counts[i].
+  uint32_t* n_pcs;
+  // after_pcs[i] is the PC of the first switch point hit after switch i, or 0
+  uint32_t* after_pcs;
 } schedule_report_t;
 
 typedef struct {
@@ -19,6 +37,9 @@ typedef struct {
   // If this is not null, record the PCs of shared memory modifying
   // instructions
   schedule_report_t* report;
+  // If set, count the switch points the last thread hits after the last
+  // switch (tail_count in ctx_switch_status_t)
+  uint32_t count_tail;
 } schedule_t;
 
 typedef struct eq_th {
@@ -35,6 +56,15 @@ typedef struct eq_th {
     uint32_t stack_end;
     uint32_t refork_cnt;
 
+    // stack owned by this pool entry, reused by every thread forked into it
+    uint32_t pool_stack;
+    uint32_t pool_stack_size;
+
+    // If not 0, the thread waits for the word at blocked_on to stop being
+    // blocked_val
+    uint32_t blocked_on;
+    uint32_t blocked_val;
+
     // how many instructions we executed.
     unsigned verbose_p;  // if you want alot of information.
 } eq_th_t;
@@ -45,19 +75,41 @@ typedef struct {
   // Set to true before R/W commits, read by prefetch abort for next instruction
   uint32_t do_instr_count;
   uint32_t yielded;
+  // The schedule switched to a blocked thread and was abandoned
+  uint32_t stuck;
+  // Every unfinished thread was blocked
+  uint32_t deadlock;
+  // Stopped at a switch whose state was visited before
+  uint32_t pruned;
+  // With count_tail, the switch points the last thread of the schedule hit
+  // after the last switch, up to when it exited or first blocked
+  uint32_t tail_count;
+  uint32_t tail_blocked;
 } ctx_switch_status_t;
 
 enum {
     EQUIV_EXIT = 0,
     EQUIV_PUTC = 1,
     EQUIV_SWITCH = 2,
-    EQUIV_YIELD = 3
+    EQUIV_YIELD = 3,
+    EQUIV_BLOCK = 4
 };
 
 typedef void (*equiv_fn_t)(void*);
 
 // Handler for touch events. Updates context switch status
-void ctx_switch_handler(set_t *touched_memory, uint32_t pc);
+void ctx_switch_handler(set_t *touched_memory, uint32_t pc, uint32_t w);
+
+// With EQUIV_MERGED_TRAPS the data abort emulates the access and calls this
+// with the registers past it, in place of the step that would follow.
+// Doesn't return if the schedule switches threads here.
+void equiv_after_access(regs_t *r);
+
+// tid of the running thread, 0 if none
+uint32_t equiv_cur_tid(void);
+
+// Stack range [start, end) of the running thread, empty if none
+void equiv_cur_stack(uint32_t *start, uint32_t *end);
 
 void print_schedule(const char* msg, schedule_t* schedule);
 
@@ -72,20 +124,44 @@ ctx_switch_status_t get_ctx_switch_status();
 // Resets the context switching state
 void reset_ctx_switch();
 
-// Sets the schedule and shared mem then turns on context switching
-void enable_ctx_switch(schedule_t* sched, set_t* shared_mem);
+// Sets the per-thread switch points (indexed by tid - 1). If NULL, every
+// access to shared memory is a switch point
+void set_switch_points(set_t** sp);
+
+// Sets the schedule, shared mem and switch points then turns on context
+// switching
+void enable_ctx_switch(schedule_t* sched, set_t* shared_mem, set_t** sp);
 
 // Disables context switching
 void disable_ctx_switch();
 
+// Visited states at context switches, or NULL. A run that reaches a switch
+// with the rest of its instruction counts at 1 and a state stored there
+// before is stopped. It only skips schedules that match ones below the run
+// that stored the state, so the search has to expand that run, as
+// run_bounded does.
+void set_visited_states(bitstate_t* b);
+
 // a very heavy handed initialization just for today's lab.
 // assumes it has total control of system calls etc.
 void equiv_init(void);
 
+// All threads are done: puts every forked thread back in the pool and
+// restarts tids at 1
 void reset_ntids();
 
+/*
+ * Threads come from a fixed pool of EQUIV_MAX_THREADS, since kmalloc never
+ * frees and every phase of every check forks. reset_ntids releases them to
+ * the back of the free list, so threads forked one after another in
+ * separate runs (like the functions find_shared_memory profiles) don't share
+ * a stack.
+ */
 eq_th_t *equiv_fork(void (*fn)(void**), void **args, uint32_t expected_hash);
 
+// With a stack of stack_size bytes instead of EQUIV_STACK_SIZE
+eq_th_t *equiv_fork_stack(void (*fn)(void**), void **args, uint32_t stack_size);
+
 eq_th_t * retrieve_tid_from_queue(uint32_t tid);
 
 // run all the threads until there are no more.
@@ -96,6 +172,10 @@ void sys_equiv_exit(uint32_t ret);
 
 void sys_equiv_yield();
 
+// Blocks the calling thread while *addr == val. Other threads run in the
+// meantime; a block is a switch point, not a lost schedule.
+void sys_equiv_block(volatile uint32_t* addr, uint32_t val);
+
 void equiv_refresh(eq_th_t *th);
 
 // don't set stack pointer.
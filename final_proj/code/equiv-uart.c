@@ -0,0 +1,64 @@
+#include "equiv-uart.h"
+
+_Static_assert((EQUIV_UART_BUF_SIZE & (EQUIV_UART_BUF_SIZE - 1)) == 0,
+  "buffer size must be a power of two");
+
+static uint8_t buf[EQUIV_UART_BUF_SIZE];
+// Free-running indices, masked on access
+static uint32_t head, tail;
+
+static uint32_t buffering = 0;
+static uint32_t stalls = 0;
+static uint32_t init = 0;
+
+static int equiv_uart_putchar(int c) {
+  equiv_uart_put8(c);
+  return c;
+}
+
+void equiv_uart_init(void) {
+  if(init)
+    return;
+  init = 1;
+  rpi_putchar_set(equiv_uart_putchar);
+}
+
+void equiv_uart_buffer_on(void) {
+#ifndef EQUIV_UART_SYNC
+  buffering = 1;
+#endif
+}
+
+void equiv_uart_buffer_off(void) {
+  buffering = 0;
+  equiv_uart_drain();
+}
+
+void equiv_uart_drain(void) {
+  while(tail != head) {
+    uart_put8(buf[tail % EQUIV_UART_BUF_SIZE]);
+    tail++;
+  }
+  uart_flush_tx();
+}
+
+void equiv_uart_put8(uint8_t c) {
+  if(!buffering) {
+    // Keep ordering with anything still queued
+    if(tail != head)
+      equiv_uart_drain();
+    uart_put8(c);
+    return;
+  }
+
+  if(head - tail == EQUIV_UART_BUF_SIZE) {
+    stalls++;
+    equiv_uart_drain();
+  }
+  buf[head % EQUIV_UART_BUF_SIZE] = c;
+  head++;
+}
+
+uint32_t equiv_uart_stalls(void) {
+  return stalls;
+}
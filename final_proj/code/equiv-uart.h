@@ -0,0 +1,43 @@
+#ifndef __EQUIV_UART_H
+#define __EQUIV_UART_H
+
+#include "rpi.h"
+
+/*
+ * Buffered UART output for the checker.
+ *
+ * While threads are being single-stepped every printk and EQUIV_PUTC goes
+ * into a ring buffer instead of the UART, so the step path never waits on
+ * the transmit FIFO. The buffer is drained when no thread is running (at
+ * the end of equiv_run), or synchronously if it fills up.
+ *
+ * Checker code that can fail while a thread runs uses equiv_panic, which
+ * drains the buffer before the board resets. An assert, or a panic inside
+ * libpi, still loses what is buffered. Build with EQUIV_UART_SYNC to write
+ * straight to the UART, e.g. to see how far a run got before it hung.
+ */
+#define EQUIV_UART_BUF_SIZE (1 << 14)
+
+// Installs the putchar hook. Safe to call more than once.
+void equiv_uart_init(void);
+
+// Start/stop buffering. Stopping drains the buffer.
+void equiv_uart_buffer_on(void);
+void equiv_uart_buffer_off(void);
+
+// Queue a byte, or write it out if buffering is off.
+void equiv_uart_put8(uint8_t c);
+
+// Write out everything buffered and wait for the UART to finish
+void equiv_uart_drain(void);
+
+// Number of times the buffer filled up while buffering
+uint32_t equiv_uart_stalls(void);
+
+// panic that writes out the buffered output first
+#define equiv_panic(msg, args...) do {  \
+    equiv_uart_buffer_off();            \
+    panic(msg, ##args);                 \
+} while(0)
+
+#endif
@@ -0,0 +1,117 @@
+#include "fp-table.h"
+#include "equiv-malloc.h"
+
+// Grow when more than 3/4 full
+#define FP_TABLE_MAX_LOAD(cap) ((cap) / 4 * 3)
+
+// The empty marker can't be a key
+static inline uint64_t fp_key(uint64_t fp) {
+  return fp ? fp : 1;
+}
+
+static inline uint32_t fp_slot(fp_table_t* t, uint64_t fp) {
+  // xxhash output is already well mixed
+  return (uint32_t)(fp ^ (fp >> 32)) & (t->capacity - 1);
+}
+
+static fp_entry_t* fp_table_alloc_entries(uint32_t capacity) {
+  fp_entry_t* e = equiv_malloc(sizeof(fp_entry_t) * capacity);
+  if(!e) panic("fingerprint table allocation failed (%d entries)!\n", capacity);
+  memset(e, 0, sizeof(fp_entry_t) * capacity);
+  return e;
+}
+
+fp_table_t* fp_table_alloc(uint32_t capacity) {
+  assert(capacity && (capacity & (capacity - 1)) == 0);
+
+  fp_table_t* t = equiv_malloc(sizeof(fp_table_t));
+  if(!t) panic("fingerprint table allocation failed!\n");
+  t->entries = fp_table_alloc_entries(capacity);
+  t->capacity = capacity;
+  t->n = 0;
+  return t;
+}
+
+void fp_table_free(fp_table_t* t) {
+  equiv_free(t->entries);
+  equiv_free(t);
+}
+
+static fp_entry_t* fp_table_probe(fp_table_t* t, uint64_t fp) {
+  uint32_t i = fp_slot(t, fp);
+  while(t->entries[i].fp && t->entries[i].fp != fp)
+    i = (i + 1) & (t->capacity - 1);
+  return &t->entries[i];
+}
+
+static void fp_table_grow(fp_table_t* t) {
+  fp_entry_t* old = t->entries;
+  uint32_t old_capacity = t->capacity;
+
+  t->capacity *= 2;
+  t->entries = fp_table_alloc_entries(t->capacity);
+  for(uint32_t i = 0; i < old_capacity; i++)
+    if(old[i].fp)
+      *fp_table_probe(t, old[i].fp) = old[i];
+  equiv_free(old);
+}
+
+fp_entry_t* fp_table_insert(fp_table_t* t, uint64_t fp, uint32_t* added) {
+  fp = fp_key(fp);
+  fp_entry_t* e = fp_table_probe(t, fp);
+  if(added) *added = !e->fp;
+  if(e->fp)
+    return e;
+
+  if(t->n + 1 > FP_TABLE_MAX_LOAD(t->capacity)) {
+    fp_table_grow(t);
+    e = fp_table_probe(t, fp);
+  }
+  e->fp = fp;
+  t->n++;
+  return e;
+}
+
+fp_entry_t* fp_table_lookup(fp_table_t* t, uint64_t fp) {
+  fp = fp_key(fp);
+  fp_entry_t* e = fp_table_probe(t, fp);
+  return e->fp ? e : NULL;
+}
+
+void print_fingerprint(const char* msg, uint64_t fp) {
+  if(msg) printk(msg);
+
+  char buf[17];
+  for(int i = 15; i >= 0; i--) {
+    buf[i] = "0123456789abcdef"[fp & 0xf];
+    fp >>= 4;
+  }
+  buf[16] = 0;
+  printk("0x%s", buf);
+}
+
+void fp_table_print_histogram(const char* msg, fp_table_t* t) {
+  if(msg) printk(msg);
+
+  // Gather the reached states and insertion sort them by hits
+  fp_entry_t** reached = equiv_malloc(sizeof(fp_entry_t*) * (t->n ? t->n : 1));
+  uint32_t n = 0;
+  uint32_t total = 0;
+  for(uint32_t i = 0; i < t->capacity; i++) {
+    fp_entry_t* e = &t->entries[i];
+    if(!e->fp || !e->hits) continue;
+    total += e->hits;
+
+    uint32_t j = n++;
+    for(; j > 0 && reached[j-1]->hits < e->hits; j--)
+      reached[j] = reached[j-1];
+    reached[j] = e;
+  }
+
+  printk("\t%d schedules reached %d distinct end states\n", total, n);
+  for(uint32_t i = 0; i < n; i++) {
+    print_fingerprint("\t", reached[i]->fp);
+    printk("\t%s\t%d\n", (reached[i]->flags & FP_VALID) ? "valid" : "INVALID", reached[i]->hits);
+  }
+  equiv_free(reached);
+}
@@ -0,0 +1,58 @@
+#ifndef __FP_TABLE_H
+#define __FP_TABLE_H
+
+#include "rpi.h"
+
+/*
+ * Table of 64-bit end state fingerprints (see hash_mem64).
+ *
+ * Open addressing with linear probing over a flat array of 16-byte entries,
+ * so a lookup is usually one or two adjacent entries. Besides marking the
+ * valid end states, every entry counts how many schedules reached it, which
+ * makes the table an outcome histogram as well.
+ */
+enum {
+  // End state of some sequential run of the functions
+  FP_VALID = 1 << 0,
+};
+
+typedef struct {
+  // 0 marks an empty slot
+  uint64_t fp;
+  uint32_t hits;
+  uint32_t flags;
+} fp_entry_t;
+
+typedef struct {
+  fp_entry_t* entries;
+  // Power of two
+  uint32_t capacity;
+  uint32_t n;
+} fp_table_t;
+
+fp_table_t* fp_table_alloc(uint32_t capacity);
+void fp_table_free(fp_table_t* t);
+
+/*
+ * Returns the entry for fp, adding an empty one if needed. *added is set
+ * if the entry is new (added may be NULL).
+ */
+fp_entry_t* fp_table_insert(fp_table_t* t, uint64_t fp, uint32_t* added);
+
+// NULL if fp is not in the table
+fp_entry_t* fp_table_lookup(fp_table_t* t, uint64_t fp);
+
+static inline uint32_t fp_table_is_valid(fp_table_t* t, uint64_t fp) {
+  fp_entry_t* e = fp_table_lookup(t, fp);
+  return e && (e->flags & FP_VALID);
+}
+
+/*
+ * Prints every end state reached by at least one schedule, most common
+ * first.
+ */
+void fp_table_print_histogram(const char* msg, fp_table_t* t);
+
+void print_fingerprint(const char* msg, uint64_t fp);
+
+#endif
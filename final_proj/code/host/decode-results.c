@@ -0,0 +1,256 @@
+// Host side decoder for the checker's binary result stream (see
+// ../result-stream.h). Copies text through and expands every record into
+// the tables the checker prints in text mode.
+//
+//    decode-results [capture-file]      (reads stdin if no file is given)
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../result-stream.h"
+
+#define MAX_TAGS 1024
+
+static struct { uint32_t addr; char* name; } tags[MAX_TAGS];
+static unsigned n_tags;
+
+// Baseline shared memory, in set order
+static uint32_t* base_addrs;
+static uint8_t* base_vals;
+static uint32_t n_base;
+
+static void die(const char* msg) {
+  fprintf(stderr, "decode-results: %s\n", msg);
+  exit(1);
+}
+
+typedef struct {
+  const uint8_t* p;
+  const uint8_t* end;
+} cursor_t;
+
+static uint8_t get8(cursor_t* c) {
+  if(c->p >= c->end) die("truncated record");
+  return *c->p++;
+}
+
+static uint32_t get32(cursor_t* c) {
+  uint32_t v = 0;
+  for(int i = 0; i < 4; i++)
+    v |= (uint32_t)get8(c) << (8 * i);
+  return v;
+}
+
+static uint64_t get64(cursor_t* c) {
+  uint64_t lo = get32(c);
+  return lo | (uint64_t)get32(c) << 32;
+}
+
+static uint32_t getvar(cursor_t* c) {
+  uint32_t v = 0;
+  for(int shift = 0; ; shift += 7) {
+    uint8_t b = get8(c);
+    v |= (uint32_t)(b & 0x7F) << shift;
+    if(!(b & 0x80)) return v;
+  }
+}
+
+static void decode_tag(cursor_t* c) {
+  if(n_tags == MAX_TAGS) die("too many tags");
+  uint32_t addr = get32(c);
+  size_t len = c->end - c->p;
+  char* name = malloc(len + 1);
+  memcpy(name, c->p, len);
+  name[len] = 0;
+  c->p = c->end;
+
+  // A later record for the same address replaces the earlier one
+  for(unsigned i = 0; i < n_tags; i++) {
+    if(tags[i].addr == addr) {
+      free(tags[i].name);
+      tags[i].name = name;
+      return;
+    }
+  }
+  tags[n_tags].addr = addr;
+  tags[n_tags].name = name;
+  n_tags++;
+}
+
+static void decode_baseline(cursor_t* c) {
+  n_base = 0;
+  uint32_t n_runs = getvar(c);
+  for(uint32_t r = 0; r < n_runs; r++) {
+    uint32_t addr = get32(c);
+    uint32_t len = getvar(c);
+    base_addrs = realloc(base_addrs, (n_base + len) * sizeof(*base_addrs));
+    base_vals = realloc(base_vals, n_base + len);
+    for(uint32_t i = 0; i < len; i++) {
+      base_addrs[n_base] = addr + i;
+      base_vals[n_base] = get8(c);
+      n_base++;
+    }
+  }
+}
+
+// Same layout as print_schedule in equiv-threads.c
+static void print_schedule(const char* msg, uint32_t n_funcs, uint32_t ncs,
+                           const uint8_t* tids, const uint32_t* counts,
+                           const uint32_t* pcs, const uint32_t* n_pcs) {
+  printf("%s", msg);
+  for(uint32_t f = 0; f < n_funcs; f++)
+    printf("\t%d", f);
+  printf("\n");
+  uint32_t k = 0;
+  for(uint32_t s = 0; s < ncs; s++) {
+    for(uint32_t i = 0; i < counts[s]; i++) {
+      for(uint32_t f = 0; f < n_funcs; f++) {
+        printf("\t");
+        if(tids[s] - 1u == f) {
+          if(pcs && i < n_pcs[s]) printf("%x", pcs[k + i]);
+          else printf("|");
+        } else printf(" ");
+      }
+      printf("\n");
+    }
+    if(pcs) k += n_pcs[s];
+  }
+  for(uint32_t f = 0; f < n_funcs; f++)
+    printf("\t%s", tids[ncs] - 1u == f ? "|" : " ");
+  printf("\n");
+  for(uint32_t f = 0; f < n_funcs; f++)
+    printf("\t%s", tids[ncs] - 1u == f ? "X" : " ");
+  printf("\n");
+}
+
+static void print_tags_in(uint32_t addr, uint32_t n) {
+  for(unsigned i = 0; i < n_tags; i++) {
+    if(tags[i].addr < addr || tags[i].addr >= addr + n) continue;
+    printf("\t%s", tags[i].name);
+    if(tags[i].addr != addr) printf("+%u", tags[i].addr - addr);
+  }
+}
+
+// Same layout as print_mem_tags in memory.c
+static void print_mem(const char* msg, const uint8_t* vals, uint64_t hash) {
+  printf("%s", msg);
+  for(uint32_t i = 0; i < n_base; ) {
+    uint32_t len = 1;
+    while(i + len < n_base && base_addrs[i + len] == base_addrs[i] + len)
+      len++;
+    uint32_t start = base_addrs[i], end = start + len;
+    if(len > 4)
+      printf("\t[%x, %x) %u bytes\n", start, end, len);
+
+    for(uint32_t a = start; a < end; ) {
+      uint32_t n = (a % 4 == 0 && end - a >= 4) ? 4 : 1;
+      const uint8_t* v = &vals[i + (a - start)];
+      uint32_t x = n == 4 ? v[0] | v[1] << 8 | v[2] << 16 | (uint32_t)v[3] << 24 : v[0];
+      printf("\t%x : %x", a, x);
+      print_tags_in(a, n);
+      printf("\n");
+      a += n;
+    }
+    i += len;
+  }
+  printf("\tHash: 0x%016llx\n", (unsigned long long)hash);
+}
+
+static void decode_schedule(cursor_t* c) {
+  uint8_t flags = get8(c);
+  uint64_t id = (flags & RESULT_HAS_ID) ? get64(c) : 0;
+  uint64_t hash = get64(c);
+  uint32_t n_funcs = get8(c);
+  uint32_t ncs = getvar(c);
+
+  uint8_t* tids = malloc(ncs + 1);
+  uint32_t* counts = malloc((ncs + 1) * sizeof(uint32_t));
+  for(uint32_t i = 0; i <= ncs; i++)
+    tids[i] = get8(c);
+  uint32_t total = 0;
+  for(uint32_t i = 0; i < ncs; i++) {
+    counts[i] = getvar(c);
+    total += counts[i];
+  }
+  uint32_t* pcs = NULL;
+  uint32_t* n_pcs = NULL;
+  if(flags & RESULT_HAS_PCS) {
+    pcs = malloc((total + 1) * sizeof(uint32_t));
+    n_pcs = malloc((ncs + 1) * sizeof(uint32_t));
+    uint32_t k = 0;
+    for(uint32_t i = 0; i < ncs; i++) {
+      n_pcs[i] = getvar(c);
+      if(n_pcs[i] > counts[i]) die("more pcs than switch points");
+      for(uint32_t j = 0; j < n_pcs[i]; j++)
+        pcs[k++] = get32(c);
+    }
+  }
+
+  uint8_t* vals = malloc(n_base + 1);
+  memcpy(vals, base_vals, n_base);
+  uint32_t n_diffs = getvar(c);
+  uint32_t idx = 0;
+  for(uint32_t i = 0; i < n_diffs; i++) {
+    idx += getvar(c);
+    uint8_t v = get8(c);
+    if(idx >= n_base) die("diff outside of the baseline");
+    vals[idx] = v;
+  }
+
+  if(flags & RESULT_YIELDED) {
+    print_schedule("Schedule yielded \n", n_funcs, ncs, tids, counts, pcs, n_pcs);
+  } else {
+    print_mem((flags & RESULT_DEADLOCK) ? "\nDeadlock detected\n" :
+      (flags & RESULT_INVALID) ?
+      "\nInvalid memory state detected\n" : "\nValid memory state detected\n",
+      vals, hash);
+    print_schedule("With schedule \n", n_funcs, ncs, tids, counts, pcs, n_pcs);
+    if(flags & RESULT_HAS_ID)
+      printf("Schedule ID: 0x%016llx\n", (unsigned long long)id);
+  }
+
+  free(vals);
+  free(pcs);
+  free(n_pcs);
+  free(counts);
+  free(tids);
+}
+
+int main(int argc, char** argv) {
+  FILE* in = stdin;
+  if(argc > 2) die("usage: decode-results [capture-file]");
+  if(argc == 2 && !(in = fopen(argv[1], "rb")))
+    die("cannot open capture file");
+
+  static uint8_t payload[1 << 16];
+  int ch;
+  while((ch = fgetc(in)) != EOF) {
+    if(ch != RESULT_ESC) {
+      putchar(ch);
+      continue;
+    }
+
+    int type = fgetc(in);
+    int lo = fgetc(in), hi = fgetc(in);
+    if(type == EOF || lo == EOF || hi == EOF) die("truncated record header");
+    size_t len = lo | hi << 8;
+    if(fread(payload, 1, len, in) != len) die("truncated record");
+
+    cursor_t c = { payload, payload + len };
+    switch(type) {
+    case RESULT_HEADER:
+      if(get32(&c) != RESULT_MAGIC) die("bad stream magic");
+      if(get8(&c) != RESULT_VERSION) die("unsupported stream version");
+      break;
+    case RESULT_TAG: decode_tag(&c); break;
+    case RESULT_BASELINE: decode_baseline(&c); break;
+    case RESULT_SCHEDULE: decode_schedule(&c); break;
+    default:
+      fprintf(stderr, "decode-results: skipping unknown record '%c'\n", type);
+      break;
+    }
+    fflush(stdout);
+  }
+  return 0;
+}
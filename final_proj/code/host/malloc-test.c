@@ -0,0 +1,96 @@
+// Host side stress test for the equiv heap allocator (../equiv-malloc.c).
+// Runs random malloc/free/realloc calls against a fixed heap, checks that
+// payloads keep their contents and alignment, and validates the whole heap
+// after every call.
+//
+//    malloc-test [iterations] [seed]
+#include <stdarg.h>
+
+#include "rpi.h"
+#include "equiv-malloc.h"
+
+#define HEAP_SIZE (1 << 19)
+#define N_PTRS 1000
+
+uint32_t validate_heap();
+
+int printk(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vprintf(fmt, ap);
+  va_end(ap);
+  return n;
+}
+
+static void die(const char* msg, unsigned long it) {
+  fprintf(stderr, "malloc-test: %s at iteration %lu\n", msg, it);
+  exit(1);
+}
+
+static void* ptrs[N_PTRS];
+static size_t sizes[N_PTRS];
+
+// Every payload is filled with its slot number
+static int check_fill(unsigned i, void* p, size_t n) {
+  for(size_t k = 0; k < n; k++)
+    if(((unsigned char*)p)[k] != (i & 0xff)) return 0;
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  unsigned long iters = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+  unsigned seed = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+
+  // Start off alignment so init has to round the heap
+  static char heap[HEAP_SIZE] __attribute__((aligned(8)));
+  if(!equiv_malloc_init(heap + 3, sizeof(heap) - 3))
+    die("init failed", 0);
+
+  srand(seed);
+  for(unsigned long it = 0; it < iters; it++) {
+    unsigned i = rand() % N_PTRS;
+    switch(rand() % 3) {
+    case 0:
+      if(ptrs[i]) break;
+      // Mostly small blocks, sometimes a large one
+      sizes[i] = 1 + rand() % (rand() % 10 == 0 ? 5000 : 100);
+      ptrs[i] = equiv_malloc(sizes[i]);
+      if(!ptrs[i]) break;
+      if((uintptr_t)ptrs[i] % ALIGNMENT) die("misaligned payload", it);
+      memset(ptrs[i], i & 0xff, sizes[i]);
+      break;
+    case 1:
+      if(!ptrs[i]) break;
+      if(!check_fill(i, ptrs[i], sizes[i])) die("payload corrupted", it);
+      equiv_free(ptrs[i]);
+      ptrs[i] = NULL;
+      break;
+    case 2: {
+      size_t n = 1 + rand() % 3000;
+      void* q = equiv_realloc(ptrs[i], n);
+      if(!q) break;
+      size_t kept = ptrs[i] ? (sizes[i] < n ? sizes[i] : n) : 0;
+      if((uintptr_t)q % ALIGNMENT) die("misaligned payload", it);
+      if(!check_fill(i, q, kept)) die("realloc lost contents", it);
+      memset(q, i & 0xff, n);
+      ptrs[i] = q;
+      sizes[i] = n;
+      break;
+    }
+    }
+    if(!validate_heap()) die("heap is corrupt", it);
+  }
+
+  // Freeing everything has to leave one free block
+  for(unsigned i = 0; i < N_PTRS; i++)
+    equiv_free(ptrs[i]);
+  if(!validate_heap()) die("heap is corrupt after freeing everything", iters);
+  equiv_heap_stats_t h;
+  equiv_heap_stats(&h);
+  if(h.blocks_used || h.blocks_free != 1)
+    die("freed heap did not coalesce", iters);
+
+  printf("malloc-test: %lu calls ok, peak %zu of %zu bytes\n",
+    iters, h.bytes_peak, h.size);
+  return 0;
+}
@@ -0,0 +1,20 @@
+// Just enough of libpi to build checker sources natively (see Makefile)
+#ifndef __HOST_RPI_H
+#define __HOST_RPI_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Defined by the host program that links the source in
+int printk(const char* fmt, ...);
+
+#define panic(msg, args...) do {                        \
+    printk("PANIC:%s:%d:" msg, __FILE__, __LINE__, ##args); \
+    abort();                                            \
+} while(0)
+#define assert(x) do { if(!(x)) panic("assert failed: %s\n", #x); } while(0)
+#define demand(x, msg...) do { if(!(x)) panic("%s\n", #msg); } while(0)
+
+#endif
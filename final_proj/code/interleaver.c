@@ -3,6 +3,13 @@
 #include "rpi.h"
 #include "equiv-malloc.h"
 #include "equiv-rw-set.h"
+#include "schedule-id.h"
+#include "coverage.h"
+#include "refine.h"
+#include "undo-log.h"
+#include "race.h"
+#include "result-stream.h"
+#include "equiv-perf.h"
 
 int verbose = 3;
 
@@ -10,163 +17,926 @@ void set_verbosity(int v){
     verbose = v;
 }
 
+int get_verbosity(void){
+    return verbose;
+}
+
+void set_binary_output(int on){
+    result_stream_enable(on);
+}
+
+static bitstate_t* bitstate = NULL;
+
+void set_bitstate(bitstate_t* b){
+    bitstate = b;
+}
+
 // NEW
 
-// runs each interleaving for a given number of instructions
+// A tid sequence is canonical if every copy of a symmetric thread first runs
+// after all lower numbered copies of the same thread have run. Relabelling
+// identical threads maps every schedule onto exactly one canonical one.
+uint32_t tids_canonical(uint32_t* tids, uint32_t n, uint32_t* sym) {
+  uint32_t seen = 0;
+  for(int i = 0; i < n; i++) {
+    uint32_t t = tids[i] - 1;
+    if(seen & (1u << t)) continue;
 
-uint32_t tids_valid(uint32_t* tids, uint32_t ncs) {
-  for(int i = 0; i < ncs - 1; i++) {
-    if(tids[i] == tids[i+1])
-      return 0;
+    for(uint32_t u = sym[t]; u < t; u++) {
+      if(sym[u] == sym[t] && !(seen & (1u << u)))
+        return 0;
+    }
+    seen |= 1u << t;
+  }
+  return 1;
+}
+
+// Same as above for a permutation of (0-based) function indices
+uint32_t perm_canonical(int* perm, size_t n_funcs, uint32_t* sym) {
+  for(size_t a = 0; a < n_funcs; a++) {
+    for(size_t b = a + 1; b < n_funcs; b++) {
+      if(sym[perm[a]] == sym[perm[b]] && perm[a] > perm[b])
+        return 0;
+    }
   }
   return 1;
 }
 
-uint32_t next_tid(uint32_t* tids, uint32_t ncs, uint32_t num_funcs) {
-  do {
-    uint32_t carry = 0;
-    for(int i = 0; i < ncs + 1; i++) {
-      // Increment
-      if(i == 0) {
-        tids[0]++;
+uint32_t find_symmetric_funcs(
+    function_exec* executables, size_t n_funcs,
+    uint32_t* sym
+) {
+  assert(n_funcs <= 32);
+
+  uint32_t n_sym = 0;
+  for(size_t i = 0; i < n_funcs; i++) {
+    sym[i] = i;
+    for(size_t j = 0; j < i; j++) {
+      if(
+        executables[j].func_addr == executables[i].func_addr &&
+        executables[j].var_list == executables[i].var_list
+      ) {
+        sym[i] = sym[j];
+        n_sym++;
+        break;
+      }
+    }
+  }
+  return n_sym;
+}
+
+typedef struct {
+  ctx_switch_status_t status;
+  // Set if the end state was compared against the valid hashes
+  uint32_t checked;
+  uint32_t invalid;
+  // Coverage bits first hit by this schedule
+  uint32_t new_coverage;
+} schedule_result_t;
+
+// Coverage of the schedule being run, if any
+static coverage_t* run_coverage = NULL;
+// Tracker for bytes missing from shared memory, if refinement is on
+static refine_t* run_refine = NULL;
+// Race detector of run_races, if running
+static race_detector_t* run_race = NULL;
+
+// Writes of the running schedule, so the next schedule of the same loop can
+// start from the initial state without calling init again
+static undo_log_t* run_undo = NULL;
+// Set once a schedule ran from the state init left
+static uint32_t run_undo_ready = 0;
+
+static void undo_loop_begin(void) {
+  run_undo = undo_log_alloc();
+  run_undo_ready = 0;
+}
+
+static void undo_loop_end(void) {
+  if(run_undo->n_overflows && verbose >= 1)
+    printk("%d schedule(s) wrote too much to roll back, reran init\n", run_undo->n_overflows);
+  undo_log_free(run_undo);
+  run_undo = NULL;
+  run_undo_ready = 0;
+}
+
+static void interleaver_touch_handler(set_t* touched, uint32_t pc, uint32_t w) {
+  ctx_switch_handler(touched, pc, w);
+  if(run_coverage)
+    coverage_touch(run_coverage, touched, pc, w, equiv_cur_tid());
+  if(run_refine)
+    refine_touch(run_refine, touched, w, equiv_cur_tid());
+  if(run_race)
+    race_touch(run_race, touched, pc, w, equiv_cur_tid());
+  if(run_undo && w) {
+    uint32_t stack_start, stack_end;
+    equiv_cur_stack(&stack_start, &stack_end);
+    undo_log_record(run_undo, touched, stack_start, stack_end);
+  }
+}
+
+// Runs a single schedule from the initial memory state and checks the end
+// state against the valid hashes. Runs that stop following the schedule
+// before its last switch are only checked if check_partial is set. With no
+// valid hashes the schedule is only run, to see where it goes.
+static schedule_result_t run_schedule(
+  eq_th_t **threads, size_t num_funcs,
+  schedule_t *schedule,
+  fp_table_t *valid_hashes,
+  init_memory_func init,
+  set_t *shared_memory,
+  set_t **switch_points,
+  memory_tags_t* tags,
+  schedule_space_t* space,
+  uint32_t check_partial,
+  coverage_t* cov
+) {
+    schedule_result_t result = { .checked = 0, .invalid = 0, .new_coverage = 0 };
+    uint32_t ncs = schedule->n_ctx_switches;
+
+    schedule_report_t* report = NULL;
+    if(verbose >= 3 || cov) {
+      // Setup of schedule report
+      report = equiv_malloc(sizeof(schedule_report_t));
+      report->pcs = equiv_malloc(sizeof(uint32_t*) * ncs);
+      for(int i = 0; i < ncs; i++)
+        report->pcs[i] = equiv_malloc(sizeof(uint32_t) * schedule->instr_counts[i]);
+      report->n_pcs = equiv_malloc(sizeof(uint32_t) * ncs);
+      report->after_pcs = equiv_malloc(sizeof(uint32_t) * ncs);
+      for(int i = 0; i < ncs; i++) {
+        report->n_pcs[i] = 0;
+        report->after_pcs[i] = 0;
       }
+    }
+    schedule->report = report;
+
+    run_coverage = cov;
+    if(cov) coverage_begin(cov);
+    if(run_refine) refine_begin(run_refine);
+
+    PERF_EVENT(SCHEDULE);
+    PERF_START(INIT);
+    // Rolling back fails if the last schedule overflowed the log
+    if(!(run_undo_ready && undo_log_rollback(run_undo)))
+      init();
+    PERF_STOP(INIT);
+    if(run_undo) undo_log_begin(run_undo);
+    result_stream_baseline(shared_memory, tags);
+    reset_threads(threads, num_funcs);
+    set_memory_touch_handler(interleaver_touch_handler);
+    enable_ctx_switch(schedule, shared_memory, switch_points);
+    rw_tracker_enable();
+
+    equiv_run();
+
+    let status = get_ctx_switch_status();
+
+    rw_tracker_disable();
+    disable_ctx_switch();
+    run_coverage = NULL;
+    run_undo_ready = run_undo != NULL;
+
+    if(cov)
+      result.new_coverage = coverage_end(cov, schedule, &status);
 
-      if(carry) {	
-        tids[i]++;
-        carry = 0;	
+    uint32_t has_id = space && schedule_in_space(space, schedule);
+    uint32_t id_flag = has_id ? RESULT_HAS_ID : 0;
+
+    if(status.yielded) {
+      if(verbose >= 3) {
+        if(result_stream_enabled())
+          result_stream_schedule(RESULT_YIELDED | id_flag,
+            has_id ? schedule_rank(space, schedule) : 0,
+            hash_mem64(shared_memory), schedule, shared_memory);
+        else
+          print_schedule("Schedule yielded \n", schedule);
       }
+    }
+
+    if(status.stuck && verbose >= 3)
+      print_schedule("Schedule switched to a blocked thread \n", schedule);
+    if(status.pruned && verbose >= 3)
+      print_schedule("Schedule reached a visited state \n", schedule);
 
-      if(tids[i] > num_funcs) {
-        tids[i] = 1;
-        carry = 1;
+    if(valid_hashes && status.deadlock) {
+      // Every unfinished thread was blocked, no end state to compare
+      result.checked = 1;
+      result.invalid = 1;
+      if(result_stream_enabled()) {
+        if(verbose >= 1)
+          result_stream_schedule(RESULT_INVALID | RESULT_DEADLOCK | id_flag,
+            has_id ? schedule_rank(space, schedule) : 0,
+            hash_mem64(shared_memory), schedule, shared_memory);
+      } else if(verbose >= 1) {
+        print_mem_tags("\nDeadlock detected\n", shared_memory, tags);
+        print_schedule("With schedule \n", schedule);
+        if(has_id) {
+          print_schedule_id("Schedule ID: ", schedule_rank(space, schedule));
+          printk("\n");
+        }
       }
     }
-    if(carry) {
-      return 0;
+    else if(valid_hashes && !status.yielded && !status.stuck && !status.pruned &&
+            (status.ctx_switch == ncs || check_partial)) {
+      // Happy state, schedule was valid
+      uint64_t hash = hash_mem64(shared_memory);
+      result.checked = 1;
+      // Unknown end states are recorded too, for the outcome histogram
+      fp_entry_t* outcome = fp_table_insert(valid_hashes, hash, NULL);
+      outcome->hits++;
+      uint32_t invalid = !(outcome->flags & FP_VALID);
+
+      if(result_stream_enabled()) {
+        if(verbose >= 3 || (invalid && verbose >= 1))
+          result_stream_schedule((invalid ? RESULT_INVALID : 0) | id_flag,
+            has_id ? schedule_rank(space, schedule) : 0,
+            hash, schedule, shared_memory);
+        result.invalid = invalid;
+      } else if(invalid) {
+        result.invalid = 1;
+        if(verbose >= 1) {
+          print_mem_tags("\nInvalid memory state detected\n", shared_memory, tags);
+          print_schedule("With schedule \n", schedule);
+          if(has_id) {
+            print_schedule_id("Schedule ID: ", schedule_rank(space, schedule));
+            printk("\n");
+          }
+        }
+      } else {
+        if(verbose >= 3) {
+          print_mem_tags("\nValid memory state detected\n", shared_memory, tags);
+          print_schedule("With schedule \n", schedule);
+        }
+      }
+    }
+
+    if(report) {
+      // Free schedule report
+      for(int i = 0; i < ncs; i++)
+        equiv_free(report->pcs[i]);
+      equiv_free(report->pcs);
+      equiv_free(report->n_pcs);
+      equiv_free(report->after_pcs);
+      equiv_free(report);
+      schedule->report = NULL;
+    }
+
+    result.status = status;
+    return result;
+}
+
+// Moves tids[depth] to the next thread that can follow tids[depth - 1] in a
+// canonical ordering, starting over from the first if it is 0.
+static uint32_t next_child_tid(uint32_t* tids, uint32_t depth, uint32_t num_funcs, uint32_t* sym) {
+  while(++tids[depth] <= num_funcs) {
+    if(depth && tids[depth] == tids[depth - 1]) continue;
+    if(tids_canonical(tids, depth + 1, sym)) return 1;
+  }
+  return 0;
+}
+
+// What run_bounded needs for every run
+static struct {
+  eq_th_t **threads;
+  size_t num_funcs;
+  fp_table_t *valid_hashes;
+  init_memory_func init;
+  set_t *shared_memory;
+  set_t **switch_points;
+  memory_tags_t *tags;
+  uint32_t max_instrs;
+  uint32_t max_ncs;
+  uint32_t *sym;
+  uint32_t *n_checked;
+  uint32_t *n_invalid;
+  uint32_t total_invalid;
+} bounded;
+
+// Runs the schedule and counts it toward its bound. Returns the largest
+// count its last slot can take in a child: the switch points the last thread
+// hit after the last switch, plus one if it then blocked (the block ends the
+// slot). 0 if it has no children.
+static uint32_t bounded_run(schedule_t* schedule) {
+  uint32_t depth = schedule->n_ctx_switches;
+  // Bound 0 is the sequential runs. They are only run to find their children.
+  uint32_t check = depth != 0;
+  schedule_space_t space = schedule_space_mk(bounded.num_funcs, depth, bounded.max_instrs);
+
+  let result = run_schedule(
+    bounded.threads, bounded.num_funcs,
+    schedule,
+    check ? bounded.valid_hashes : NULL,
+    bounded.init,
+    bounded.shared_memory,
+    bounded.switch_points,
+    bounded.tags,
+    &space,
+    0,
+    NULL
+  );
+  let status = result.status;
+  bounded.n_checked[depth] += result.checked;
+  bounded.n_invalid[depth] += result.invalid;
+  bounded.total_invalid += result.invalid;
+
+  uint32_t reached = !status.yielded && !status.stuck && !status.pruned &&
+    !status.deadlock && status.ctx_switch == depth;
+  if(!reached || depth >= bounded.max_ncs)
+    return 0;
+  return status.tail_count + status.tail_blocked;
+}
+
+// Depth first through everything below a schedule that was already run with
+// root switches and whose last slot can take up to limit.
+static void bounded_dfs(schedule_t* schedule, uint32_t root, uint32_t limit, uint32_t* limits) {
+  uint32_t *tids = schedule->tids;
+  uint32_t *instr_nums = schedule->instr_counts;
+
+  limits[root] = limit;
+  instr_nums[root] = 1;
+  tids[root + 1] = 0;
+  uint32_t depth = root + 1;
+  while(depth > root) {
+    // Next sibling: the next thread to switch to, then the next count of the
+    // parent's last slot, then back up a level
+    if(!next_child_tid(tids, depth, bounded.num_funcs, bounded.sym)) {
+      if(instr_nums[depth - 1] < limits[depth - 1]) {
+        instr_nums[depth - 1]++;
+        tids[depth] = 0;
+      } else
+        depth--;
+      continue;
     }
-  } while(!tids_valid(tids, ncs + 1));
+
+    schedule->n_ctx_switches = depth;
+    uint32_t l = bounded_run(schedule);
+    if(l) {
+      limits[depth] = l;
+      instr_nums[depth] = 1;
+      tids[depth + 1] = 0;
+      depth++;
+    }
+  }
+  schedule->n_ctx_switches = root;
+}
+
+// Schedules of one bound that have children, each stored as its limit, its
+// tids and its instruction counts
+typedef struct {
+  uint32_t *words;
+  uint32_t n;
+  uint32_t cap;
+} frontier_t;
+
+static uint32_t frontier_push(frontier_t* f, schedule_t* s, uint32_t limit) {
+  uint32_t d = s->n_ctx_switches;
+  uint32_t size = 2 * d + 2;
+  if(f->n + size > f->cap) {
+    uint32_t cap = f->cap ? f->cap * 2 : 256;
+    while(cap < f->n + size) cap *= 2;
+    if(cap * sizeof(uint32_t) > BOUNDED_FRONTIER_BYTES)
+      return 0;
+    uint32_t *words = equiv_realloc(f->words, cap * sizeof(uint32_t));
+    if(!words)
+      return 0;
+    f->words = words;
+    f->cap = cap;
+  }
+  uint32_t *w = f->words + f->n;
+  w[0] = limit;
+  memcpy(w + 1, s->tids, (d + 1) * sizeof(uint32_t));
+  memcpy(w + 2 + d, s->instr_counts, d * sizeof(uint32_t));
+  f->n += size;
   return 1;
 }
 
-void run_interleavings(
-  function_exec* executables,size_t num_funcs,
-  set_t *valid_hashes,
+uint32_t run_bounded(
+  function_exec* executables, size_t num_funcs,
+  fp_table_t *valid_hashes,
   init_memory_func init,
-  int ncs,
+  int max_ncs,
+  uint32_t max_instrs,
   set_t *shared_memory,
-  memory_tags_t* tags
+  set_t **switch_points,
+  memory_tags_t* tags,
+  refine_t* refine,
+  uint32_t* n_checked,
+  uint32_t* n_invalid
 ) {
+    assert(max_ncs > 0 && max_ncs < 32);
     equiv_init();
 
     disable_ctx_switch();
     eq_th_t *threads[num_funcs];
     init_threads(threads, executables, num_funcs);
     reset_threads(threads, num_funcs);
+    undo_loop_begin();
+    run_refine = refine;
+    // A pruned schedule and everything below it match one that is expanded,
+    // whichever order the search takes, so visited states hold for the
+    // whole search
+    if(bitstate) bitstate_clear(bitstate);
+    set_visited_states(bitstate);
 
-    uint32_t *tids       = (uint32_t *)equiv_malloc((ncs + 1) * sizeof(uint32_t));
-    uint32_t *instr_nums = (uint32_t *)equiv_malloc((ncs)     * sizeof(uint32_t));
+    uint32_t sym[num_funcs];
+    find_symmetric_funcs(executables, num_funcs, sym);
 
-    // Generate an initial thread ordering
-    for (int i = 0; i < ncs + 1; i++) {
-        tids[i] = 1;
+    uint32_t *tids       = (uint32_t *)equiv_malloc((max_ncs + 1) * sizeof(uint32_t));
+    uint32_t *instr_nums = (uint32_t *)equiv_malloc((max_ncs)     * sizeof(uint32_t));
+    uint32_t *limits     = (uint32_t *)equiv_malloc((max_ncs)     * sizeof(uint32_t));
+    schedule_t schedule = {
+      .tids = tids,
+      .instr_counts = instr_nums,
+      .n_ctx_switches = 0,
+      .n_funcs = num_funcs,
+      .count_tail = 1
+    };
+
+    bounded.threads = threads;
+    bounded.num_funcs = num_funcs;
+    bounded.valid_hashes = valid_hashes;
+    bounded.init = init;
+    bounded.shared_memory = shared_memory;
+    bounded.switch_points = switch_points;
+    bounded.tags = tags;
+    bounded.max_instrs = max_instrs;
+    bounded.max_ncs = max_ncs;
+    bounded.sym = sym;
+    bounded.n_checked = n_checked;
+    bounded.n_invalid = n_invalid;
+    bounded.total_invalid = 0;
+
+    // One bound at a time. The schedules of a bound are the children of the
+    // ones before it, so each schedule is run once and a bound is done, and
+    // reported, before the next starts. A schedule whose children don't fit
+    // in the frontier has them searched depth first right away instead.
+    frontier_t cur = { 0 }, next = { 0 };
+    tids[0] = 0;
+    while(next_child_tid(tids, 0, num_funcs, sym)) {
+      schedule.n_ctx_switches = 0;
+      uint32_t l = bounded_run(&schedule);
+      if(l && !frontier_push(&cur, &schedule, l))
+        bounded_dfs(&schedule, 0, l, limits);
     }
-    next_tid(tids, ncs, num_funcs);
 
-    // Generate an initial instruction count set
-    for (int i = 0; i < ncs; i++) {
-        instr_nums[i] = 1;
+    for(uint32_t d = 0; d < max_ncs; d++) {
+      for(uint32_t i = 0; i < cur.n; i += 2 * d + 2) {
+        uint32_t *w = cur.words + i;
+        uint32_t limit = w[0];
+        memcpy(tids, w + 1, (d + 1) * sizeof(uint32_t));
+        memcpy(instr_nums, w + 2 + d, d * sizeof(uint32_t));
+
+        for(instr_nums[d] = 1; instr_nums[d] <= limit; instr_nums[d]++) {
+          tids[d + 1] = 0;
+          while(next_child_tid(tids, d + 1, num_funcs, sym)) {
+            schedule.n_ctx_switches = d + 1;
+            uint32_t l = bounded_run(&schedule);
+            if(l && !frontier_push(&next, &schedule, l))
+              bounded_dfs(&schedule, d + 1, l, limits);
+          }
+        }
+      }
+
+      printk("%d context switch(es): %d schedule(s) checked, %d invalid\n",
+        d + 1, n_checked[d + 1], n_invalid[d + 1]);
+
+      equiv_free(cur.words);
+      cur = next;
+      next.words = NULL;
+      next.n = next.cap = 0;
     }
+    equiv_free(cur.words);
+
+    run_refine = NULL;
+    set_visited_states(NULL);
+    undo_loop_end();
+    equiv_free(limits);
+    equiv_free(instr_nums);
+    equiv_free(tids);
+    return bounded.total_invalid;
+}
+
+uint32_t run_races(
+  function_exec* executables, size_t num_funcs,
+  init_memory_func init,
+  race_detector_t* rd
+) {
+    equiv_init();
+
+    disable_ctx_switch();
+    eq_th_t *threads[num_funcs];
+    init_threads(threads, executables, num_funcs);
+    reset_threads(threads, num_funcs);
 
-    uint32_t done = 0;
+    // No preemption: each thread runs to completion, starting with a
+    // different one each run
+    uint32_t tids[1];
     schedule_t schedule = {
       .tids = tids,
-      .instr_counts = instr_nums,
-      .n_ctx_switches = ncs,
-      .n_funcs = num_funcs
+      .instr_counts = NULL,
+      .n_ctx_switches = 0,
+      .n_funcs = num_funcs,
+      .report = NULL
     };
-    while(!done) {
-      schedule_report_t* report = NULL;
-      if(verbose >= 3) {
-        // Setup of schedule report
-        report = equiv_malloc(sizeof(schedule_report_t*));
-        report->pcs = equiv_malloc(sizeof(uint32_t*) * schedule.n_ctx_switches);
-        for(int i = 0; i < schedule.n_ctx_switches; i++)
-          report->pcs[i] = equiv_malloc(sizeof(uint32_t) * schedule.instr_counts[i]);
-        
-      }
-      schedule.report = report;
 
+    for(uint32_t first = 1; first <= num_funcs; first++) {
+      tids[0] = first;
+
+      PERF_START(INIT);
       init();
+      PERF_STOP(INIT);
       reset_threads(threads, num_funcs);
-      set_memory_touch_handler(ctx_switch_handler);
-      enable_ctx_switch(&schedule, shared_memory);
+      race_begin(rd);
+      run_race = rd;
+      set_memory_touch_handler(interleaver_touch_handler);
+      enable_ctx_switch(&schedule, NULL, NULL);
       rw_tracker_enable();
 
       equiv_run();
 
-      let status = get_ctx_switch_status();
-      
       rw_tracker_disable();
       disable_ctx_switch();
+      run_race = NULL;
+    }
 
-      if(status.yielded) {
-        if(verbose >= 3) {
-          print_schedule("Schedule yielded \n", &schedule);
-        }
+    return rd->n_reports;
+}
+
+uint64_t run_schedule_ids(
+  function_exec* executables, size_t num_funcs,
+  fp_table_t *valid_hashes,
+  init_memory_func init,
+  schedule_space_t* space,
+  uint64_t first_id, uint64_t n_ids,
+  set_t *shared_memory,
+  set_t **switch_points,
+  memory_tags_t* tags
+) {
+    equiv_init();
+
+    uint32_t ncs = space->n_ctx_switches;
+    uint64_t size = schedule_space_size(space);
+    if(first_id >= size) return first_id;
+    if(n_ids > size - first_id) n_ids = size - first_id;
+
+    disable_ctx_switch();
+    eq_th_t *threads[num_funcs];
+    init_threads(threads, executables, num_funcs);
+    reset_threads(threads, num_funcs);
+    undo_loop_begin();
+
+    uint32_t sym[num_funcs];
+    find_symmetric_funcs(executables, num_funcs, sym);
+
+    schedule_t schedule = {
+      .tids = equiv_malloc((ncs + 1) * sizeof(uint32_t)),
+      .instr_counts = equiv_malloc((ncs + 1) * sizeof(uint32_t)),
+      .n_ctx_switches = ncs,
+      .n_funcs = num_funcs
+    };
+
+    uint32_t n_run = 0, n_reached = 0;
+    uint64_t id;
+    for(id = first_id; id < first_id + n_ids; id++) {
+      schedule_unrank(space, id, &schedule);
+
+      // Symmetric copies of a canonical schedule are not run
+      if(tids_canonical(schedule.tids, ncs + 1, sym)) {
+        let status = run_schedule(
+          threads, num_funcs,
+          &schedule,
+          valid_hashes,
+          init,
+          shared_memory,
+          switch_points,
+          tags,
+          space,
+          0,
+          NULL
+        ).status;
+        n_run++;
+        // Schedules whose threads run out of switch points before the
+        // requested count are equivalent to a smaller ID and are not checked
+        if(!status.yielded && !status.stuck && status.ctx_switch == ncs) n_reached++;
       }
-      
-      if(!status.yielded && status.ctx_switch == ncs) {
-        // Happy state, schedule was valid
-        uint32_t hash = hash_mem(shared_memory);
-
-        if(!set_lookup(valid_hashes, hash)) {
-          if(verbose >= 1) {
-            print_mem_tags("\nInvalid memory state detected\n", shared_memory, tags);
-            print_schedule("With schedule \n", &schedule);
-          }
-        } else {
-          if(verbose >= 3) {
-            print_mem_tags("\nValid memory state detected\n", shared_memory, tags);
-            print_schedule("With schedule \n", &schedule);
-          }
-        }
+
+      if(verbose >= 1 && (id + 1) % 4096 == 0) {
+        print_schedule_id("Completed schedules below ID ", id + 1);
+        printk("\n");
       }
+    }
 
-      if(verbose >= 3) {
-        // Free schedule report
-        for(int i = 0; i < schedule.n_ctx_switches; i++)
-          equiv_free(report->pcs[i]);
-        equiv_free(report->pcs);
-        equiv_free(report);
+    if(verbose >= 1) {
+      printk("Ran %d schedules (%d reached every switch) up to ", n_run, n_reached);
+      print_schedule_id(NULL, id);
+      printk("\n");
+    }
+
+    undo_loop_end();
+    equiv_free(schedule.instr_counts);
+    equiv_free(schedule.tids);
+    return id;
+}
+
+void run_pct(
+  function_exec* executables, size_t num_funcs,
+  fp_table_t *valid_hashes,
+  init_memory_func init,
+  pct_t* pct,
+  uint32_t max_runs, uint32_t budget_usec,
+  set_t *shared_memory,
+  set_t **switch_points,
+  memory_tags_t* tags
+) {
+    equiv_init();
+
+    disable_ctx_switch();
+    eq_th_t *threads[num_funcs];
+    init_threads(threads, executables, num_funcs);
+    reset_threads(threads, num_funcs);
+    undo_loop_begin();
+
+    uint32_t max_switches = pct_max_switches(pct);
+    schedule_t schedule = {
+      .tids = equiv_malloc((max_switches + 1) * sizeof(uint32_t)),
+      .instr_counts = equiv_malloc((max_switches + 1) * sizeof(uint32_t)),
+      .n_funcs = num_funcs
+    };
+
+    uint32_t n_runs = 0, n_checked = 0, n_invalid = 0;
+    uint32_t start = timer_get_usec();
+    uint32_t elapsed = 0;
+    while((!max_runs || n_runs < max_runs) && (!budget_usec || elapsed < budget_usec)) {
+      pct_sample(pct, &schedule);
+
+      // Sampled counts come from solo runs, so a thread can finish before its
+      // switch. The run is still a real execution and is checked.
+      let result = run_schedule(
+        threads, num_funcs,
+        &schedule,
+        valid_hashes,
+        init,
+        shared_memory,
+        switch_points,
+        tags,
+        NULL,
+        1,
+        NULL
+      );
+
+      n_runs++;
+      n_checked += result.checked;
+      if(result.invalid) {
+        n_invalid++;
+        if(verbose >= 1)
+          printk("Found by PCT run %d (seed %x)\n", n_runs, pct->seed);
+      }
+      elapsed = timer_get_usec() - start;
+    }
+
+    if(verbose >= 1) {
+      uint64_t inv_p = pct_inverse_probability(pct);
+      printk("\nPCT: %d runs (%d checked, %d invalid) in %d ms, seed %x\n",
+        n_runs, n_checked, n_invalid, elapsed / 1000, pct->seed);
+      if(elapsed)
+        printk("\t%d schedules/sec\n", (uint32_t)((uint64_t)n_runs * 1000000 / elapsed));
+      printk("\t%d threads, %d shared-access steps, depth %d\n",
+        num_funcs, pct->total_steps, pct->depth);
+      if(inv_p <= UINT32_MAX) {
+        printk("\tEach run finds a depth %d bug with probability >= 1/%u\n",
+          pct->depth, (uint32_t)inv_p);
+        // Expected number of runs hitting such a bug, in hundredths
+        uint32_t hits = (uint32_t)((uint64_t)n_runs * 100 / inv_p);
+        printk("\tExpected detections of any one such bug: %d.%d%d\n",
+          hits / 100, (hits / 10) % 10, hits % 10);
+      } else {
+        printk("\tDepth %d guarantee is below 2^-32 per run\n", pct->depth);
       }
+    }
+
+    undo_loop_end();
+    equiv_free(schedule.instr_counts);
+    equiv_free(schedule.tids);
+}
+
+// Schedules kept by the fuzzer because they found new coverage
+#define FUZZ_CORPUS_SIZE 256
+
+typedef struct {
+  uint64_t id;
+  // Times the entry will be favoured when picking what to mutate
+  uint32_t energy;
+} fuzz_entry_t;
+
+static uint64_t fuzz_rand64(uint32_t* state) {
+  uint64_t hi = xorshift32(state);
+  return (hi << 32) | xorshift32(state);
+}
+
+// Picks a new thread for position i of the tid sequence that differs from
+// its neighbours. Returns the one there now if there is none.
+static uint32_t fuzz_pick_tid(uint32_t* state, schedule_t* s, uint32_t i) {
+  uint32_t n = s->n_funcs;
+  uint32_t prev = i > 0 ? s->tids[i-1] : 0;
+  uint32_t next = i < s->n_ctx_switches ? s->tids[i+1] : 0;
+  uint32_t tid = (xorshift32(state) % n) + 1;
+  for(uint32_t k = 0; k < n; k++) {
+    if(tid != prev && tid != next && tid != s->tids[i])
+      return tid;
+    tid = (tid % n) + 1;
+  }
+  return s->tids[i];
+}
+
+static void fuzz_mutate(uint32_t* state, schedule_space_t* space, schedule_t* s) {
+  uint32_t ncs = s->n_ctx_switches;
+  uint32_t n_ops = 1 + (xorshift32(state) % 4 == 0 ? xorshift32(state) % 4 : 0);
+
+  for(uint32_t op = 0; op < n_ops; op++) {
+    uint32_t r = xorshift32(state);
+    if(!ncs || r % 3 == 2) {
+      // Switch one slot to a different thread, if one fits between its
+      // neighbours. With two threads none does, so move a switch instead.
+      uint32_t i = (r >> 2) % (ncs + 1);
+      uint32_t tid = fuzz_pick_tid(state, s, i);
+      if(tid != s->tids[i]) {
+        s->tids[i] = tid;
+        continue;
+      }
+      if(!ncs) continue;
+    }
+
+    // Move one context switch a little, or anywhere
+    uint32_t i = (r >> 2) % ncs;
+    int32_t count = s->instr_counts[i];
+    if(r % 3 == 0) count += (int32_t)((r >> 16) % 5) - 2;
+    else count = ((r >> 16) % space->max_instrs) + 1;
+    if(count < 1) count = 1;
+    if(count > space->max_instrs) count = space->max_instrs;
+    s->instr_counts[i] = count;
+  }
+}
 
-      // Advance instruction numbers
-      if(status.ctx_switch > 0) {
-        instr_nums[status.ctx_switch - 1]++;
-        if(status.ctx_switch < ncs) {
-          for(int i = status.ctx_switch; i < ncs; i++)
-            instr_nums[i] = 1;
+void run_fuzz(
+  function_exec* executables, size_t num_funcs,
+  fp_table_t *valid_hashes,
+  init_memory_func init,
+  schedule_space_t* space,
+  uint32_t seed,
+  uint32_t max_runs, uint32_t budget_usec,
+  set_t *shared_memory,
+  set_t **switch_points,
+  memory_tags_t* tags
+) {
+    equiv_init();
+
+    uint32_t ncs = space->n_ctx_switches;
+    uint64_t size = schedule_space_size(space);
+    uint32_t state = seed ? seed : 0x9e3779b9;
+
+    disable_ctx_switch();
+    eq_th_t *threads[num_funcs];
+    init_threads(threads, executables, num_funcs);
+    reset_threads(threads, num_funcs);
+    undo_loop_begin();
+
+    uint32_t sym[num_funcs];
+    find_symmetric_funcs(executables, num_funcs, sym);
+
+    schedule_t schedule = {
+      .tids = equiv_malloc((ncs + 1) * sizeof(uint32_t)),
+      .instr_counts = equiv_malloc((ncs + 1) * sizeof(uint32_t)),
+      .n_ctx_switches = ncs,
+      .n_funcs = num_funcs
+    };
+
+    coverage_t* cov = coverage_alloc(shared_memory);
+    fuzz_entry_t* corpus = equiv_malloc(sizeof(fuzz_entry_t) * FUZZ_CORPUS_SIZE);
+    uint32_t n_corpus = 0;
+
+    uint32_t n_runs = 0, n_invalid = 0;
+    // Non-canonical picks, which count against max_runs too
+    uint32_t n_skipped = 0;
+    uint32_t start = timer_get_usec();
+    uint32_t elapsed = 0;
+    while((!max_runs || n_runs + n_skipped < max_runs) && (!budget_usec || elapsed < budget_usec)) {
+      uint64_t id;
+      if(!n_corpus || xorshift32(&state) % 8 == 0) {
+        // Fresh random schedule
+        id = fuzz_rand64(&state) % size;
+      } else {
+        // Mutate the more energetic of two random corpus entries
+        fuzz_entry_t* a = &corpus[xorshift32(&state) % n_corpus];
+        fuzz_entry_t* b = &corpus[xorshift32(&state) % n_corpus];
+        fuzz_entry_t* e = a->energy >= b->energy ? a : b;
+        if(e->energy) e->energy--;
+
+        schedule_unrank(space, e->id, &schedule);
+        fuzz_mutate(&state, space, &schedule);
+        id = schedule_rank(space, &schedule);
+      }
+
+      schedule_unrank(space, id, &schedule);
+      elapsed = timer_get_usec() - start;
+      if(!tids_canonical(schedule.tids, ncs + 1, sym)) {
+        n_skipped++;
+        continue;
+      }
+
+      let result = run_schedule(
+        threads, num_funcs,
+        &schedule,
+        valid_hashes,
+        init,
+        shared_memory,
+        switch_points,
+        tags,
+        space,
+        1,
+        cov
+      );
+      n_runs++;
+      n_invalid += result.invalid;
+
+      if(result.new_coverage) {
+        fuzz_entry_t* slot;
+        if(n_corpus < FUZZ_CORPUS_SIZE) {
+          slot = &corpus[n_corpus++];
+        } else {
+          // Replace the most exhausted entry
+          slot = &corpus[0];
+          for(uint32_t i = 1; i < n_corpus; i++)
+            if(corpus[i].energy < slot->energy) slot = &corpus[i];
         }
+        slot->id = id;
+        slot->energy = 4 + (result.new_coverage < 28 ? result.new_coverage : 28);
       }
-      // Advance TIDs
-      else {
-        for(int i = 0; i < ncs; i++) instr_nums[i] = 1;
-        if(!next_tid(tids, ncs, num_funcs)) done = 1;
+
+      if(verbose >= 1 && n_runs % 256 == 0) {
+        printk("fuzz: %d runs, %d coverage bits, corpus %d, %d invalid\n",
+          n_runs, cov->n_covered, n_corpus, n_invalid);
       }
+      elapsed = timer_get_usec() - start;
     }
+
+    if(verbose >= 1) {
+      printk("\nFuzz: %d runs (%d invalid) in %d ms, seed %x\n",
+        n_runs, n_invalid, elapsed / 1000, seed);
+      if(n_skipped)
+        printk("\t%d non-canonical schedule(s) skipped\n", n_skipped);
+      if(elapsed)
+        printk("\t%d schedules/sec\n", (uint32_t)((uint64_t)n_runs * 1000000 / elapsed));
+      printk("\t%d coverage bits, corpus of %d schedules\n", cov->n_covered, n_corpus);
+    }
+
+    equiv_free(corpus);
+    coverage_free(cov);
+    undo_loop_end();
+    equiv_free(schedule.instr_counts);
+    equiv_free(schedule.tids);
+}
+
+void find_switch_counts(
+    function_exec* executables, size_t n_funcs,
+    set_t** switch_points, uint32_t* counts
+) {
+  for(size_t i = 0; i < n_funcs; i++) {
+    set_t* pcs = set_alloc();
+    counts[i] = find_pc_set(executables[i].func_addr, switch_points[i], pcs);
+    set_free(pcs);
+
+    if(verbose >= 3)
+      printk("Thread %d hits %d switch points when run alone\n", i, counts[i]);
+  }
 }
 
 void find_good_hashes(
     function_exec* executables, size_t n_funcs,
     init_memory_func init,
     int** itl, size_t n_perms,
-    set_t* shared_memory, set_t* valid_hashes
+    set_t* shared_memory, fp_table_t* valid_hashes
 ) {
   if(verbose >= 3){
     printk("Finding valid end states\n");
   }
+
+  // Permutations that only reorder identical functions reach the same state
+  uint32_t sym[n_funcs];
+  uint32_t n_sym = find_symmetric_funcs(executables, n_funcs, sym);
+  if(n_sym && verbose >= 1) {
+    printk("Found %d symmetric function(s):", n_sym);
+    for(size_t i = 0; i < n_funcs; i++) {
+      if(sym[i] != i) printk(" %d=%d", i, sym[i]);
+    }
+    printk("\n");
+  }
+
   for(size_t i = 0; i < n_perms; i++) {
+    if(!perm_canonical(itl[i], n_funcs, sym)) continue;
+
+    PERF_START(INIT);
     init();
+    PERF_STOP(INIT);
 
     // Run (no need for single stepping)
     for (size_t j = 0; j < n_funcs; j++) {
@@ -174,8 +944,10 @@ void find_good_hashes(
       executables[itl[i][j]].func_addr(executables[itl[i][j]].var_list);
     }
 
-    uint32_t hash = hash_mem(shared_memory);
-    if(!set_insert(valid_hashes, hash) && verbose >= 3) {
+    uint64_t hash = hash_mem64(shared_memory);
+    uint32_t added;
+    fp_table_insert(valid_hashes, hash, &added)->flags |= FP_VALID;
+    if(added && verbose >= 3) {
       print_mem("Valid state found: \n", shared_memory);
       printk("\tPermutation: ");
       for(size_t j = 0; j < n_funcs; j++) {
@@ -186,60 +958,119 @@ void find_good_hashes(
   }
 }
 
+typedef struct {
+  uint32_t* v;
+  uint32_t n;
+} sorted_bytes_t;
+
+static void sorted_bytes_append(uint32_t v, void* arg) {
+  sorted_bytes_t* a = arg;
+  a->v[a->n++] = v;
+}
+
+// Flattens a set into an ascending array
+static sorted_bytes_t sorted_bytes(set_t* s) {
+  sorted_bytes_t a = { .n = 0 };
+  uint32_t n = set_cardinality(s);
+  a.v = equiv_malloc(sizeof(uint32_t) * (n ? n : 1));
+  set_foreach(s, sorted_bytes_append, &a);
+  assert(a.n == n);
+  return a;
+}
+
+// ORs bit into masks[k] for every byte of a that is union->v[k]. Both arrays
+// are ascending and a is a subset of union, so this is one merge pass.
+static void mark_accesses(sorted_bytes_t* a, sorted_bytes_t* all, uint32_t* masks, uint32_t bit) {
+  uint32_t k = 0;
+  for(uint32_t i = 0; i < a->n; i++) {
+    while(all->v[k] != a->v[i]) k++;
+    masks[k] |= bit;
+  }
+}
+
 void find_shared_memory(
     function_exec* executables, size_t n_funcs,
-    set_t* shared_memory
+    set_t* shared_memory, set_t** switch_points
 ) {
+  demand(n_funcs <= 32, per-byte thread masks hold at most 32 functions);
+
   // Allocate read & write sets & compute them
-  set_t** read_sets = equiv_malloc(sizeof(set_t*) * n_funcs);
-  set_t** write_sets = equiv_malloc(sizeof(set_t*) * n_funcs);
+  set_t* all_set = set_alloc();
+  sorted_bytes_t* reads = equiv_malloc(sizeof(sorted_bytes_t) * n_funcs);
+  sorted_bytes_t* writes = equiv_malloc(sizeof(sorted_bytes_t) * n_funcs);
   for(size_t i = 0; i < n_funcs; i++) {
-    read_sets[i] = set_alloc();
-    write_sets[i] = set_alloc();
+    set_t* read_set = set_alloc();
+    set_t* write_set = set_alloc();
 
-    find_rw_set(executables[i].func_addr, read_sets[i], write_sets[i]);
+    find_rw_set(executables[i].func_addr, read_set, write_set);
 
     if(verbose >= 3) {
       printk("Read set #%d\n", i);
-      set_print(NULL, read_sets[i]);
+      set_print(NULL, read_set);
       printk("Write set #%d\n", i);
-      set_print(NULL, write_sets[i]);
+      set_print(NULL, write_set);
     }
-  }
 
+    set_union_inplace(all_set, read_set);
+    set_union_inplace(all_set, write_set);
+    reads[i] = sorted_bytes(read_set);
+    writes[i] = sorted_bytes(write_set);
+    set_free(read_set);
+    set_free(write_set);
+  }
 
+  // Which threads read and write every accessed byte
+  sorted_bytes_t all = sorted_bytes(all_set);
+  set_free(all_set);
+  uint32_t* readers = equiv_malloc(sizeof(uint32_t) * (all.n ? all.n : 1));
+  uint32_t* writers = equiv_malloc(sizeof(uint32_t) * (all.n ? all.n : 1));
+  memset(readers, 0, sizeof(uint32_t) * all.n);
+  memset(writers, 0, sizeof(uint32_t) * all.n);
   for(size_t i = 0; i < n_funcs; i++) {
-    for(size_t j = 0; j < n_funcs; j++) {
-      if(i == j) continue;
-
-      set_t* tmp = set_alloc();
+    mark_accesses(&reads[i], &all, readers, 1u << i);
+    mark_accesses(&writes[i], &all, writers, 1u << i);
+    equiv_free(reads[i].v);
+    equiv_free(writes[i].v);
+  }
+  equiv_free(reads);
+  equiv_free(writes);
 
-      set_intersection(tmp, read_sets[i], write_sets[j]);
-      set_union_inplace(shared_memory, tmp);
+  for(uint32_t k = 0; k < all.n; k++) {
+    uint32_t r = readers[k], w = writers[k];
+    uint32_t a = r | w;
 
-      set_free(tmp);
-    }
-  }
+    // Shared: read by one thread and written by another
+    if(!w || !r || !(a & (a - 1))) continue;
+    set_insert(shared_memory, all.v[k]);
 
-  for(size_t i = 0; i < n_funcs; i++) {
-    for(size_t j = i+1; j < n_funcs; j++) {
-      set_t* tmp = set_alloc();
+    if(verbose >= 3)
+      printk("\t%x readers %x writers %x\n", all.v[k], r, w);
 
-      set_intersection(tmp, read_sets[i], write_sets[j]);
-      set_union_inplace(shared_memory, tmp);
+    if(!switch_points) continue;
 
-      set_free(tmp);
+    // Thread i only needs to switch on shared bytes that another thread
+    // writes, or that it writes and another thread reads or writes
+    for(size_t i = 0; i < n_funcs; i++) {
+      uint32_t others = ~(1u << i);
+      if((w & others) || ((w & (1u << i)) && (a & others)))
+        set_insert(switch_points[i], all.v[k]);
     }
   }
 
-  /*for(int i = 0; i < n_funcs; i++) {
-    set_free(read_sets[i]);
-    set_free(write_sets[i]);
-  }*/
+  equiv_free(readers);
+  equiv_free(writers);
+  equiv_free(all.v);
 
   if(verbose >= 1) {
     set_print("Automagically found shared memory: \n", shared_memory);
   }
+
+  if(switch_points && verbose >= 3) {
+    for(size_t i = 0; i < n_funcs; i++) {
+      printk("Switch points #%d\n", i);
+      set_print(NULL, switch_points[i]);
+    }
+  }
 }
 
 void reset_threads(eq_th_t **thread_arr, size_t num_threads){
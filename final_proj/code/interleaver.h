@@ -2,6 +2,17 @@
 #define __INTERLEAVER_H
 #include "memory.h"
 #include "equiv-threads.h"
+#include "schedule-id.h"
+#include "pct.h"
+#include "fp-table.h"
+#include "refine.h"
+#include "race.h"
+
+// Most equiv heap run_bounded keeps for the schedules of one bound whose
+// children are still to run. Past it the rest are searched depth first.
+#ifndef BOUNDED_FRONTIER_BYTES
+#define BOUNDED_FRONTIER_BYTES (1024 * 128)
+#endif
 
 typedef void (*func_ptr)(void**);
 
@@ -12,6 +23,19 @@ typedef struct {
 } function_exec; 
 
 void set_verbosity(int v);
+int get_verbosity(void);
+
+/*
+ * Send checked schedules as binary records (see result-stream.h) instead of
+ * printing tables. Decode them on the host with host/decode-results.
+ */
+void set_binary_output(int on);
+
+/*
+ * Bitstate store for pruning revisited states in run_bounded (see
+ * bitstate.h), or NULL to run every schedule.
+ */
+void set_bitstate(bitstate_t* b);
 
 // New
 
@@ -21,23 +45,126 @@ void find_good_hashes(
     function_exec* executables, size_t n_funcs,
     init_memory_func init,
     int** itl, size_t n_perms,
-    set_t* shared_memory, set_t* valid_hashes
+    set_t* shared_memory, fp_table_t* valid_hashes
+);
+
+/*
+ * Finds functions that are identical to an earlier one (same function and
+ * variables). sym[i] is set to the lowest index identical to i. Returns the
+ * number of functions that are copies of an earlier one.
+ */
+uint32_t find_symmetric_funcs(
+    function_exec* executables, size_t n_funcs,
+    uint32_t* sym
 );
 
+/*
+ * Finds the bytes read by one function and written by another. If
+ * switch_points is not NULL it must hold n_funcs empty sets, which are filled
+ * with the shared bytes each function can actually race on. Both come out of
+ * one pass over per-byte reader/writer masks, so n_funcs is at most 32.
+ */
 void find_shared_memory(
     function_exec* executables, size_t n_funcs,
-    set_t* shared_memory
+    set_t* shared_memory, set_t** switch_points
 );
 
-void run_interleavings(
-  function_exec* executables,size_t num_funcs,
-  set_t *valid_hashes,
+/*
+ * Runs every schedule with 1 to max_ncs context switches, one bound at a
+ * time. The schedules of a bound are the children of the ones before it:
+ * the run of a schedule tells where its last thread can be switched out, so
+ * each schedule is run once and no run is spent on a count past the end of a
+ * thread. Each bound's totals are printed as soon as it is done.
+ *
+ * Checked and invalid schedules are added to n_checked and n_invalid, which
+ * hold max_ncs + 1 entries indexed by bound (0, the sequential runs, is never
+ * checked). Returns the number of invalid schedules found by this call. If
+ * refine is not NULL, bytes missing from shared memory are collected into
+ * it. max_instrs is only used for schedule IDs.
+ */
+uint32_t run_bounded(
+  function_exec* executables, size_t num_funcs,
+  fp_table_t *valid_hashes,
   init_memory_func init,
-  int ncs,
+  int max_ncs,
+  uint32_t max_instrs,
   set_t *shared_memory,
+  set_t **switch_points,
+  memory_tags_t* tags,
+  refine_t* refine,
+  uint32_t* n_checked,
+  uint32_t* n_invalid
+);
+
+/*
+ * Runs the functions under the race detector, once per starting thread and
+ * without preemption. Returns the number of racing PC pairs found.
+ */
+uint32_t run_races(
+  function_exec* executables, size_t num_funcs,
+  init_memory_func init,
+  race_detector_t* rd
+);
+
+/*
+ * Runs the schedules with IDs [first_id, first_id + n_ids) from the given
+ * schedule space. Returns the first ID that was not run, so a long run can be
+ * split into ranges or resumed.
+ */
+uint64_t run_schedule_ids(
+  function_exec* executables, size_t num_funcs,
+  fp_table_t *valid_hashes,
+  init_memory_func init,
+  schedule_space_t* space,
+  uint64_t first_id, uint64_t n_ids,
+  set_t *shared_memory,
+  set_t **switch_points,
+  memory_tags_t* tags
+);
+
+/*
+ * Runs schedules sampled by PCT until max_runs schedules have run or
+ * budget_usec has passed (0 disables either limit). Reports throughput and
+ * the probabilistic guarantee at the end.
+ */
+void run_pct(
+  function_exec* executables, size_t num_funcs,
+  fp_table_t *valid_hashes,
+  init_memory_func init,
+  pct_t* pct,
+  uint32_t max_runs, uint32_t budget_usec,
+  set_t *shared_memory,
+  set_t **switch_points,
+  memory_tags_t* tags
+);
+
+/*
+ * Coverage-guided exploration. Schedules of the space are run and scored by
+ * the switch pairs and read-from pairs they exercise (see coverage.h).
+ * Schedules that hit new coverage are kept and preferentially mutated. Stops
+ * after max_runs schedules, counting the non-canonical ones that were
+ * skipped, or budget_usec microseconds (0 disables a limit).
+ */
+void run_fuzz(
+  function_exec* executables, size_t num_funcs,
+  fp_table_t *valid_hashes,
+  init_memory_func init,
+  schedule_space_t* space,
+  uint32_t seed,
+  uint32_t max_runs, uint32_t budget_usec,
+  set_t *shared_memory,
+  set_t **switch_points,
   memory_tags_t* tags
 );
 
+/*
+ * Counts how many switch points each function hits when run alone
+ */
+void find_switch_counts(
+    function_exec* executables, size_t n_funcs,
+    set_t** switch_points, uint32_t* counts
+);
+
 // Old
 
 void reset_threads(eq_th_t **thread_arr, size_t num_threads);
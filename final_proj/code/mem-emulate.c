@@ -0,0 +1,248 @@
+#include "mem-emulate.h"
+#include "equiv-rw-set.h"
+
+// Emulated exclusive monitor
+static uint32_t excl_open;
+static uint32_t excl_addr;
+
+void mem_emulate_clrex(void) { excl_open = 0; }
+
+// Register as an operand: the pc reads as the instruction + 8
+static uint32_t reg_get(regs_t* r, uint32_t n) {
+  uint32_t v = r->regs[n];
+  return n == REGS_PC ? v + 8 : v;
+}
+
+// Little endian, byte by byte when unaligned (ARMv6 unaligned support)
+static uint32_t load(uint32_t addr, uint32_t n) {
+  if(n == 4 && addr % 4 == 0) return *(volatile uint32_t*)addr;
+  if(n == 2 && addr % 2 == 0) return *(volatile uint16_t*)addr;
+  uint32_t v = 0;
+  for(uint32_t i = 0; i < n; i++)
+    v |= (uint32_t)*(volatile uint8_t*)(addr + i) << (8 * i);
+  return v;
+}
+
+static void store(uint32_t addr, uint32_t v, uint32_t n) {
+  if(n == 4 && addr % 4 == 0) { *(volatile uint32_t*)addr = v; return; }
+  if(n == 2 && addr % 2 == 0) { *(volatile uint16_t*)addr = v; return; }
+  for(uint32_t i = 0; i < n; i++)
+    *(volatile uint8_t*)(addr + i) = v >> (8 * i);
+}
+
+// A5-9 scaled register offset
+static uint32_t shifted_rm(regs_t* r, uint32_t instruction) {
+  uint32_t rm = reg_get(r, bits_get(instruction, 0, 3));
+  uint32_t imm = bits_get(instruction, 7, 11);
+  switch(bits_get(instruction, 5, 6)) {
+    case 0b00: return rm << imm;
+    case 0b01: return imm ? rm >> imm : 0;
+    case 0b10: return imm ? (uint32_t)((int32_t)rm >> imm)
+                          : ((int32_t)rm < 0 ? ~0 : 0);
+    default:
+      if(imm) return (rm >> imm) | (rm << (32 - imm));
+      // RRX
+      return (bit_isset(r->regs[REGS_CPSR], 29) << 31) | (rm >> 1);
+  }
+}
+
+// A5-18 LDR/STR/LDRB/STRB (and the T forms, the same thing from user mode)
+static uint32_t emulate_word_byte(regs_t* r, uint32_t instruction, uint32_t n) {
+  uint32_t p = bit_isset(instruction, 24);
+  uint32_t u = bit_isset(instruction, 23);
+  uint32_t w = bit_isset(instruction, 21);
+  uint32_t l = bit_isset(instruction, 20);
+  uint32_t rn = bits_get(instruction, 16, 19);
+  uint32_t rd = bits_get(instruction, 12, 15);
+
+  uint32_t offset = bit_isset(instruction, 25) ? shifted_rm(r, instruction)
+                                               : bits_get(instruction, 0, 11);
+  uint32_t base = reg_get(r, rn);
+  uint32_t moved = u ? base + offset : base - offset;
+  uint32_t addr = p ? moved : base;
+  uint32_t wb = !p || w;
+  if(wb && (rn == REGS_PC || (l && rn == rd)))
+    return 0;
+
+  uint32_t next = r->regs[REGS_PC] + 4;
+  if(l) {
+    uint32_t v = load(addr, n);
+    if(rd == REGS_PC && (n != 4 || (v & 1)))
+      return 0;
+    if(wb) r->regs[rn] = moved;
+    r->regs[rd] = v;
+    if(rd != REGS_PC) r->regs[REGS_PC] = next;
+  } else {
+    store(addr, reg_get(r, rd), n);
+    if(wb) r->regs[rn] = moved;
+    r->regs[REGS_PC] = next;
+  }
+  return 1;
+}
+
+// A5-33 LDRH/STRH/LDRSB/LDRSH/LDRD/STRD
+static uint32_t emulate_misc(regs_t* r, uint32_t instruction) {
+  uint32_t p = bit_isset(instruction, 24);
+  uint32_t u = bit_isset(instruction, 23);
+  uint32_t w = bit_isset(instruction, 21);
+  uint32_t l = bit_isset(instruction, 20);
+  uint32_t rn = bits_get(instruction, 16, 19);
+  uint32_t rd = bits_get(instruction, 12, 15);
+  uint32_t lsh = (l << 2) | bits_get(instruction, 5, 6);
+  uint32_t dbl = lsh == 0b010 || lsh == 0b011;
+
+  uint32_t offset = bit_isset(instruction, 22)
+    ? (bits_get(instruction, 8, 11) << 4) | bits_get(instruction, 0, 3)
+    : reg_get(r, bits_get(instruction, 0, 3));
+  uint32_t base = reg_get(r, rn);
+  uint32_t moved = u ? base + offset : base - offset;
+  uint32_t addr = p ? moved : base;
+  uint32_t wb = !p || w;
+
+  if(rd == REGS_PC || (dbl && (rd % 2 || rd == REGS_LR)))
+    return 0;
+  uint32_t loads = lsh != 0b001 && lsh != 0b011;
+  if(wb && (rn == REGS_PC || (loads && (rn == rd || (dbl && rn == rd + 1)))))
+    return 0;
+
+  switch(lsh) {
+    // STRH
+    case 0b001: store(addr, r->regs[rd], 2); break;
+    // LDRH
+    case 0b101: r->regs[rd] = load(addr, 2); break;
+    // LDRSH
+    case 0b111: r->regs[rd] = (int32_t)(int16_t)load(addr, 2); break;
+    // LDRSB
+    case 0b110: r->regs[rd] = (int32_t)(int8_t)load(addr, 1); break;
+    // LDRD
+    case 0b010:
+      r->regs[rd] = load(addr, 4);
+      r->regs[rd + 1] = load(addr + 4, 4);
+      break;
+    // STRD
+    case 0b011:
+      store(addr, r->regs[rd], 4);
+      store(addr + 4, r->regs[rd + 1], 4);
+      break;
+    default:
+      return 0;
+  }
+  if(wb) r->regs[rn] = moved;
+  r->regs[REGS_PC] += 4;
+  return 1;
+}
+
+// A5-41 LDM/STM. Lowest register at the lowest address.
+static uint32_t emulate_multiple(regs_t* r, uint32_t instruction, uint32_t n_bytes) {
+  uint32_t p = bit_isset(instruction, 24);
+  uint32_t u = bit_isset(instruction, 23);
+  uint32_t w = bit_isset(instruction, 21);
+  uint32_t l = bit_isset(instruction, 20);
+  uint32_t rn = bits_get(instruction, 16, 19);
+  uint32_t list = bits_get(instruction, 0, 15);
+
+  // S bit: user registers or exception return, never from user mode
+  if(bit_isset(instruction, 22) || rn == REGS_PC || !list)
+    return 0;
+
+  uint32_t base = r->regs[rn];
+  uint32_t start = u ? (p ? base + 4 : base)
+                     : (p ? base - n_bytes : base - n_bytes + 4);
+  uint32_t moved = u ? base + n_bytes : base - n_bytes;
+  uint32_t next = r->regs[REGS_PC] + 4;
+
+  if(l) {
+    if(w && ((list >> rn) & 1))
+      return 0;
+    // The pc is loaded last, from the highest address
+    if(((list >> REGS_PC) & 1) && (load(start + n_bytes - 4, 4) & 1))
+      return 0;
+
+    uint32_t addr = start;
+    for(uint32_t i = 0; i < 16; i++) {
+      if((list >> i) & 1) {
+        r->regs[i] = load(addr, 4);
+        addr += 4;
+      }
+    }
+    if(!((list >> REGS_PC) & 1))
+      r->regs[REGS_PC] = next;
+  } else {
+    // Values before writeback, so a stored base is the original one
+    uint32_t addr = start;
+    for(uint32_t i = 0; i < 16; i++) {
+      if((list >> i) & 1) {
+        store(addr, reg_get(r, i), 4);
+        addr += 4;
+      }
+    }
+    r->regs[REGS_PC] = next;
+  }
+  if(w) r->regs[rn] = moved;
+  return 1;
+}
+
+// A4-212 SWP/SWPB
+static uint32_t emulate_swap(regs_t* r, uint32_t instruction, uint32_t n) {
+  uint32_t rn = bits_get(instruction, 16, 19);
+  uint32_t rd = bits_get(instruction, 12, 15);
+  uint32_t rm = bits_get(instruction, 0, 3);
+  if(rn == REGS_PC || rd == REGS_PC || rm == REGS_PC)
+    return 0;
+
+  uint32_t addr = r->regs[rn];
+  uint32_t old = load(addr, n);
+  store(addr, r->regs[rm], n);
+  r->regs[rd] = old;
+  r->regs[REGS_PC] += 4;
+  return 1;
+}
+
+// A4-52 LDREX, A4-202 STREX and the byte/halfword/double forms
+static uint32_t emulate_exclusive(regs_t* r, uint32_t instruction, uint32_t n) {
+  uint32_t rn = bits_get(instruction, 16, 19);
+  uint32_t rd = bits_get(instruction, 12, 15);
+  uint32_t addr = r->regs[rn];
+  if(rn == REGS_PC || rd == REGS_PC)
+    return 0;
+
+  if(bit_isset(instruction, 20)) {
+    if(n == 8 && (rd % 2 || rd == REGS_LR))
+      return 0;
+    if(n == 8) {
+      r->regs[rd] = load(addr, 4);
+      r->regs[rd + 1] = load(addr + 4, 4);
+    } else
+      r->regs[rd] = load(addr, n);
+    excl_open = 1;
+    excl_addr = addr;
+  } else {
+    uint32_t rt = bits_get(instruction, 0, 3);
+    if(rt == REGS_PC || rd == rn || rd == rt || (n == 8 && (rt % 2 || rt == REGS_LR || rd == rt + 1)))
+      return 0;
+    uint32_t ok = excl_open && excl_addr == addr;
+    if(ok && n == 8) {
+      store(addr, r->regs[rt], 4);
+      store(addr + 4, r->regs[rt + 1], 4);
+    } else if(ok)
+      store(addr, r->regs[rt], n);
+    excl_open = 0;
+    r->regs[rd] = !ok;
+  }
+  r->regs[REGS_PC] += 4;
+  return 1;
+}
+
+uint32_t mem_emulate(regs_t* r) {
+  uint32_t pc = r->regs[REGS_PC];
+  uint32_t instruction = GET32(pc);
+  mem_access_t a = mem_access_at(pc);
+  switch(a.kind) {
+    case MEM_WORD_BYTE: return emulate_word_byte(r, instruction, a.n_bytes);
+    case MEM_MISC:      return emulate_misc(r, instruction);
+    case MEM_MULTIPLE:  return emulate_multiple(r, instruction, a.n_bytes);
+    case MEM_SWAP:      return emulate_swap(r, instruction, a.n_bytes);
+    case MEM_EXCLUSIVE: return emulate_exclusive(r, instruction, a.n_bytes);
+    default:            return 0;
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef __MEM_EMULATE_H
+#define __MEM_EMULATE_H
+
+#include "rpi.h"
+#include "switchto.h"
+
+/*
+ * Emulation of the user-mode loads and stores the rw tracker faults on.
+ *
+ * Called from the data abort with the faulting thread's registers. The access
+ * is performed at privileged level and r is updated as if the instruction
+ * had run: destination and base registers written back, the pc moved past
+ * it (or loaded). Only runs for instructions whose condition passed, since
+ * only those fault.
+ *
+ * Exclusive loads/stores use a single emulated monitor. It is cleared on
+ * every thread switch, so a STREX after a switch fails like it would after
+ * a CLREX.
+ */
+
+/*
+ * Performs the access of the instruction at r's pc. Returns 0 without touching
+ * anything for encodings that are unpredictable or not handled: S-bit
+ * LDM/STM, PC as a written-back base, odd LDRD/STRD registers, Thumb
+ * interworking loads into the pc.
+ */
+uint32_t mem_emulate(regs_t* r);
+
+void mem_emulate_clrex(void);
+
+#endif
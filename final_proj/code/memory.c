@@ -2,6 +2,8 @@
 #define XXH_INLINE_ALL 1
 #include "xxhash.h"
 #include "equiv-malloc.h"
+#include "equiv-perf.h"
+#include "fp-table.h"
 
 // initialize ptr_og_list in memory state with a copy of the values in ptr_list
 void initialize_memory_state(memory_segments* memory_state) {
@@ -72,37 +74,103 @@ char* get_tag(memory_tags_t* tags, void* addr) {
   return NULL;
 }
 
-void print_mem_value(uint32_t v, void* arg) {
-  printk("\t%x : %x", v, *((volatile char*)v));
-  if(arg) {
-    char* tag = get_tag((memory_tags_t*)arg, (char*)v);
-    if(tag) {
-      printk("\t");
-      printk(tag);
-    }
+typedef struct {
+  memory_tags_t* tags;
+  // Tag indices sorted by address, and the first one not passed yet
+  uint32_t* order;
+  uint32_t next;
+} print_walk_t;
+
+// Prints the tags in [addr, addr + n). Ranges come in ascending order, so
+// the sorted tags are walked once per print.
+static void print_mem_tags_in(print_walk_t* p, uint32_t addr, uint32_t n) {
+  memory_tags_t* tags = p->tags;
+  while(p->next < tags->n_tags && tags->tag_bases[p->order[p->next]] < addr)
+    p->next++;
+  while(p->next < tags->n_tags && tags->tag_bases[p->order[p->next]] < addr + n) {
+    uint32_t t = p->order[p->next++];
+    printk("\t");
+    printk(tags->tags[t]);
+    if(tags->tag_bases[t] != addr)
+      printk("+%d", tags->tag_bases[t] - addr);
+  }
+}
+
+static void print_mem_range(uint32_t start, uint32_t len, void* arg) {
+  print_walk_t* p = arg;
+  uint32_t end = start + len;
+  if(len > 4)
+    printk("\t[%x, %x) %d bytes\n", start, end, len);
+
+  for(uint32_t a = start; a < end; ) {
+    // Whole words where alignment allows, bytes at the edges
+    uint32_t n = (a % 4 == 0 && end - a >= 4) ? 4 : 1;
+    if(n == 4) printk("\t%x : %x", a, *(volatile uint32_t*)a);
+    else       printk("\t%x : %x", a, *(volatile uint8_t*)a);
+    if(p->tags)
+      print_mem_tags_in(p, a, n);
+    printk("\n");
+    a += n;
   }
-  printk("\n");
 }
 
 void print_mem_tags(const char* msg, set_t* mem, memory_tags_t* tags) {
   if(msg) printk(msg);
-  set_foreach(mem, print_mem_value, tags);
-  printk("\tHash: %x\n", hash_mem(mem));
+
+  print_walk_t p = { .tags = tags, .order = NULL, .next = 0 };
+  if(tags && tags->n_tags) {
+    // Insertion sort, there are only a handful of tags
+    p.order = equiv_malloc(sizeof(uint32_t) * tags->n_tags);
+    for(uint32_t i = 0; i < tags->n_tags; i++) {
+      uint32_t j = i;
+      for(; j > 0 && tags->tag_bases[p.order[j - 1]] > tags->tag_bases[i]; j--)
+        p.order[j] = p.order[j - 1];
+      p.order[j] = i;
+    }
+  } else {
+    p.tags = NULL;
+  }
+
+  set_foreach_range(mem, print_mem_range, &p);
+  if(p.order) equiv_free(p.order);
+  print_fingerprint("\tHash: ", hash_mem64(mem));
+  printk("\n");
 }
 
 void print_mem(const char* msg, set_t* mem) {
   print_mem_tags(msg, mem, NULL);
 }
 
-void hash_mem_value(uint32_t v, void* arg) {
+// One update per run of consecutive bytes; the digest is the same as
+// hashing byte by byte
+static void hash_mem_range(uint32_t start, uint32_t len, void* arg) {
   XXH32_state_t* state = (XXH32_state_t*)arg;
-  XXH32_update(state, (char*)v, 1);
+  XXH32_update(state, (char*)start, len);
 }
 
 uint32_t hash_mem(set_t* mem) {
-  XXH32_state_t* state = XXH32_createState();
-  set_foreach(mem, hash_mem_value, state);
-  XXH32_hash_t hash = XXH32_digest(state);
+  PERF_START(HASH_MEM);
+  // On the stack: XXH32_createState would kmalloc a state per call
+  XXH32_state_t state;
+  XXH32_reset(&state, 0);
+  set_foreach_range(mem, hash_mem_range, &state);
+  XXH32_hash_t hash = XXH32_digest(&state);
+  PERF_STOP(HASH_MEM);
+  return hash;
+}
+
+static void hash_mem64_range(uint32_t start, uint32_t len, void* arg) {
+  XXH64_state_t* state = (XXH64_state_t*)arg;
+  XXH64_update(state, (char*)start, len);
+}
+
+uint64_t hash_mem64(set_t* mem) {
+  PERF_START(HASH_MEM);
+  XXH64_state_t state;
+  XXH64_reset(&state, 0);
+  set_foreach_range(mem, hash_mem64_range, &state);
+  XXH64_hash_t hash = XXH64_digest(&state);
+  PERF_STOP(HASH_MEM);
   return hash;
 }
 
@@ -37,5 +37,7 @@ void print_mem(const char* msg, set_t* mem);
 void print_mem_tags(const char* msg, set_t* mem, memory_tags_t* tags);
 void add_mem(set_t* mem, void* base, size_t size);
 uint32_t hash_mem(set_t* mem);
+// 64-bit fingerprint of the bytes in mem, used to compare end states
+uint64_t hash_mem64(set_t* mem);
 
 #endif
@@ -3,6 +3,8 @@
 #include "rpi.h"
 #include "armv6-debug-impl.h"
 #include "mini-step.h"
+#include "equiv-perf.h"
+#include "equiv-uart.h"
 
 // currently only handle a single breakpoint.
 static step_handler_t step_handler = 0;
@@ -15,6 +17,15 @@ void ss_on_exit(int exitcode);
 // error checking.
 static int single_step_on_p;
 
+step_fast_t step_fast;
+_Static_assert(__builtin_offsetof(step_fast_t, ok) == 0, "offset used in full-except-asm.S");
+_Static_assert(__builtin_offsetof(step_fast_t, dacr) == 4, "offset used in full-except-asm.S");
+_Static_assert(__builtin_offsetof(step_fast_t, n) == 8, "offset used in full-except-asm.S");
+_Static_assert(__builtin_offsetof(step_fast_t, faults_on) == 12, "offset used in full-except-asm.S");
+_Static_assert(__builtin_offsetof(step_fast_t, scan_bits) == 16, "offset used in full-except-asm.S");
+_Static_assert(__builtin_offsetof(step_fast_t, scan_start) == 20, "offset used in full-except-asm.S");
+_Static_assert(__builtin_offsetof(step_fast_t, scan_end) == 24, "offset used in full-except-asm.S");
+
 // registers where we started single-stepping
 static regs_t start_regs;
 
@@ -51,6 +62,7 @@ uint32_t mismatch_pc_set(uint32_t pc) {
 void mismatch_on(void) {
     assert(!single_step_on_p);
     single_step_on_p = 1;
+    step_fast_stop();
 
     // can keep doing.
     cp14_enable();
@@ -63,6 +75,7 @@ void mismatch_on(void) {
 void mismatch_off(void) {
     assert(single_step_on_p);
     single_step_on_p = 0;
+    step_fast_stop();
 
     // RMW bcr0 to disable breakpoint, 
     // make sure you do a prefetch_flush!
@@ -77,7 +90,7 @@ void mismatch_off(void) {
 
 // once the traced code calls this, it's done.
 void ss_on_exit(int exitcode) {
-    panic("should never reach this!\n");
+    equiv_panic("should never reach this!\n");
 }
 
 // when we get a mismatch fault.
@@ -92,6 +105,9 @@ void ss_on_exit(int exitcode) {
 //    return (if you don't do this what happens?)
 // 5. use switch() to to resume.
 static void mismatch_fault(regs_t *r) {
+    step_fast_stop();
+    PERF_EVENT(PREFETCH_ABORT);
+    PERF_START(MISMATCH_FAULT);
     uint32_t pc = r->regs[15];
 
     // example of using intrinsic built-in routines
@@ -109,13 +125,10 @@ static void mismatch_fault(regs_t *r) {
     // todo("setup a mismatch on pc");
     mismatch_pc_set(pc);
 
-    // otherwise there is a race condition if we are 
-    // stepping through the uart code --- note: we could
-    // just check the pc and the address range of
-    // uart.o
-    while(!uart_can_put8())
-        ;
-
+    // no need to wait on the uart: stepped code never touches
+    // it (thread output goes through EQUIV_PUTC) and handler
+    // output is buffered by equiv-uart.c until the run ends.
+    PERF_STOP(MISMATCH_FAULT);
     switchto(r);
 }
 
@@ -197,15 +210,11 @@ uint32_t mini_step_run(void (*fn)(void*), void *arg) {
 // }
 void mismatch_run(regs_t *r) {
     uint32_t pc = r->regs[REGS_PC];
+    step_fast_stop();
 
     mismatch_pc_set(pc);
 
-    // otherwise there is a race condition if we are 
-    // stepping through the uart code --- note: we could
-    // just check the pc and the address range of
-    // uart.o
-    while(!uart_can_put8())
-        ;
-
+    // no uart wait, see mismatch_fault
+    PERF_STOP(MISMATCH_FAULT);
     switchto(r);
 }
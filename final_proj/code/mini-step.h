@@ -29,6 +29,35 @@ void mini_step_init(step_handler_t h, void *data);
 // run <fn> in single step mode with <arg>
 uint32_t mini_step_run(void (*fn)(void*), void *arg);
 
+// State the prefetch fast path in full-except-asm.S reads: field offsets
+// are hard-coded there.
+typedef struct {
+    // set by the step handler when the next step needs nothing but the
+    // mismatch moved and the tracker re-armed.  cleared by every step
+    // that reaches C.
+    uint32_t ok;
+    // DACR that arms the tracker, 0 to leave it alone.
+    uint32_t dacr;
+    // steps taken without calling C.
+    uint32_t n;
+    // the tracker is armed (the DACR holds <dacr>).  a fast step only
+    // writes the DACR when this is 0 and the next pc can access memory.
+    uint32_t faults_on;
+    // load/store bitmap of .user from user_scan_init: bit i is the
+    // instruction at scan_start + 4*i.  pcs outside [scan_start, scan_end)
+    // always arm.
+    uint32_t *scan_bits;
+    uint32_t scan_start;
+    uint32_t scan_end;
+} step_fast_t;
+extern step_fast_t step_fast;
+
+static inline void step_fast_allow(uint32_t dacr) {
+    step_fast.dacr = dacr;
+    step_fast.ok = 1;
+}
+static inline void step_fast_stop(void) { step_fast.ok = 0; }
+
 // new.
 void mismatch_on(void);
 void mismatch_off(void);
@@ -0,0 +1,99 @@
+#include "pct.h"
+
+pct_t pct_mk(uint32_t n_funcs, uint32_t* steps, uint32_t depth, uint32_t seed) {
+  assert(depth >= 1);
+
+  pct_t p = {
+    .seed = seed,
+    // xorshift gets stuck at 0
+    .state = seed ? seed : 0x9e3779b9,
+    .n_funcs = n_funcs,
+    .depth = depth,
+    .steps = steps,
+    .total_steps = 0
+  };
+  for(uint32_t i = 0; i < n_funcs; i++)
+    p.total_steps += steps[i];
+  return p;
+}
+
+uint32_t pct_rand(pct_t* p) {
+  return xorshift32(&p->state);
+}
+
+uint32_t pct_max_switches(pct_t* p) {
+  // One switch per change point and one per finished thread
+  return (p->depth - 1) + (p->n_funcs - 1);
+}
+
+void pct_sample(pct_t* p, schedule_t* s) {
+  uint32_t n = p->n_funcs;
+  uint32_t prio[n];
+  uint32_t remaining[n];
+
+  // Random permutation of the initial priorities depth .. depth + n - 1
+  for(uint32_t i = 0; i < n; i++) {
+    prio[i] = p->depth + i;
+    remaining[i] = p->steps[i];
+  }
+  for(uint32_t i = n - 1; i > 0; i--) {
+    uint32_t j = pct_rand(p) % (i + 1);
+    uint32_t tmp = prio[i];
+    prio[i] = prio[j];
+    prio[j] = tmp;
+  }
+
+  // Change point i lowers the running thread's priority to i
+  uint32_t change[p->depth];
+  for(uint32_t i = 1; i < p->depth; i++)
+    change[i] = p->total_steps ? (pct_rand(p) % p->total_steps) + 1 : 0;
+
+  s->n_funcs = n;
+  s->n_ctx_switches = 0;
+
+  uint32_t cur = n;
+  uint32_t count = 0;
+  for(uint32_t step = 1; step <= p->total_steps; step++) {
+    // Highest priority thread that still has steps
+    uint32_t next = n;
+    for(uint32_t t = 0; t < n; t++) {
+      if(remaining[t] && (next == n || prio[t] > prio[next]))
+        next = t;
+    }
+    assert(next != n);
+
+    if(next != cur) {
+      if(cur != n) {
+        s->instr_counts[s->n_ctx_switches] = count;
+        s->n_ctx_switches++;
+      }
+      s->tids[s->n_ctx_switches] = next + 1;
+      cur = next;
+      count = 0;
+    }
+
+    remaining[cur]--;
+    count++;
+
+    for(uint32_t i = 1; i < p->depth; i++) {
+      if(change[i] == step)
+        prio[cur] = i;
+    }
+  }
+
+  // Nothing touches shared memory, just run the first thread
+  if(cur == n)
+    s->tids[0] = 1;
+
+  assert(s->n_ctx_switches <= pct_max_switches(p));
+}
+
+uint64_t pct_inverse_probability(pct_t* p) {
+  uint64_t x = p->n_funcs;
+  uint64_t k = p->total_steps ? p->total_steps : 1;
+  for(uint32_t i = 1; i < p->depth; i++) {
+    if(x > UINT64_MAX / k) return UINT64_MAX;
+    x *= k;
+  }
+  return x;
+}
@@ -0,0 +1,69 @@
+#ifndef __PCT_H
+#define __PCT_H
+
+#include "rpi.h"
+#include "equiv-threads.h"
+
+/*
+ * Probabilistic concurrency testing (Burckhardt et al., ASPLOS '10).
+ *
+ * Every thread gets a random initial priority of at least depth, and depth - 1
+ * priority change points are picked uniformly among the k shared-access steps
+ * of a run. The highest priority thread that still has steps runs; when it
+ * executes a change point its priority drops below every initial priority. A
+ * bug that needs depth ordering constraints is hit by a single run with
+ * probability at least 1 / (n * k^(depth - 1)).
+ *
+ * Sampled schedules are ordinary schedule_t's: a thread switch happens
+ * whenever the running thread changes.
+ */
+typedef struct {
+  // Seed and current state of the xorshift PRNG
+  uint32_t seed;
+  uint32_t state;
+
+  uint32_t n_funcs;
+  // Number of priority change points is depth - 1
+  uint32_t depth;
+  // Number of shared-access steps per thread, and their sum (k)
+  uint32_t* steps;
+  uint32_t total_steps;
+} pct_t;
+
+/*
+ * xorshift32 step. State must not be 0.
+ */
+static inline uint32_t xorshift32(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+pct_t pct_mk(uint32_t n_funcs, uint32_t* steps, uint32_t depth, uint32_t seed);
+
+/*
+ * Next value of the PRNG. The same seed always gives the same sequence.
+ */
+uint32_t pct_rand(pct_t* p);
+
+/*
+ * Largest number of context switches a sampled schedule can have
+ */
+uint32_t pct_max_switches(pct_t* p);
+
+/*
+ * Samples a schedule. s->tids and s->instr_counts must have room for
+ * pct_max_switches() switches.
+ */
+void pct_sample(pct_t* p, schedule_t* s);
+
+/*
+ * n * k^(depth - 1): one run finds a depth bug with probability at least one
+ * over this. Saturates at UINT64_MAX.
+ */
+uint64_t pct_inverse_probability(pct_t* p);
+
+#endif
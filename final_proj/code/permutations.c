@@ -1,5 +1,6 @@
 #include "permutations.h"
 #include "rpi.h"
+#include "equiv-malloc.h"
 
 void swap(int *a, int *b) {
     int temp = *a;
@@ -32,21 +33,30 @@ int factorial(int n) {
 }
 
 void find_permutations(int **itl, int num_funcs) {
-    int *arr = kmalloc(num_funcs * sizeof(int)); 
+    int *arr = equiv_malloc(num_funcs * sizeof(int)); 
     for (int i = 0; i < num_funcs; i++) {
         arr[i] = i;
     }
 
     int count = 0;
     permute(itl, arr, 0, num_funcs - 1, &count);
+    equiv_free(arr);
 }
 
 int** get_func_permutations(int num_funcs){
     const size_t num_perms = factorial(num_funcs);
-    int **itl = kmalloc(num_perms * sizeof(int *));
+    int **itl = equiv_malloc(num_perms * sizeof(int *));
     for (int i = 0; i < num_perms; i++) {
-        itl[i] = kmalloc(num_funcs * sizeof(int));
+        itl[i] = equiv_malloc(num_funcs * sizeof(int));
     }
     find_permutations(itl, num_funcs);
     return itl;
+}
+
+void free_func_permutations(int **itl, int num_funcs) {
+    const size_t num_perms = factorial(num_funcs);
+    for (int i = 0; i < num_perms; i++) {
+        equiv_free(itl[i]);
+    }
+    equiv_free(itl);
 }
\ No newline at end of file
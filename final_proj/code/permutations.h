@@ -2,4 +2,5 @@ void swap(int *a, int *b);
 void permute(int **itl, int *arr, int start, int end, int *count);
 int factorial(int n);
 void find_permutations(int **itl, int num_funcs);
-int** get_func_permutations(int num_funcs);
\ No newline at end of file
+int** get_func_permutations(int num_funcs);
+void free_func_permutations(int **itl, int num_funcs);
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include "race.h"
+#include "equiv-malloc.h"
+#include "equiv-threads.h"
+#include "equiv-rw-set.h"
+
+race_detector_t* race_alloc(uint32_t n_threads, set_t* sites) {
+  demand(n_threads <= RACE_MAX_THREADS, too many threads for the race detector);
+
+  race_detector_t* rd = equiv_malloc(sizeof(race_detector_t));
+  if(!rd) panic("race detector allocation failed!");
+  memset(rd, 0, sizeof(race_detector_t));
+  rd->shadow = equiv_malloc(sizeof(race_shadow_t) * RACE_MAX_BYTES);
+  if(!rd->shadow) panic("race detector allocation failed!");
+  rd->n_threads = n_threads;
+  rd->sites = sites;
+  return rd;
+}
+
+void race_free(race_detector_t* rd) {
+  equiv_free(rd->shadow);
+  equiv_free(rd);
+}
+
+void race_begin(race_detector_t* rd) {
+  // Everything init did happens before every thread
+  memset(rd->clocks, 0, sizeof(rd->clocks));
+  for(uint32_t t = 0; t < rd->n_threads; t++)
+    rd->clocks[t][t] = 1;
+  memset(rd->shadow, 0, sizeof(race_shadow_t) * RACE_MAX_BYTES);
+  rd->n_shadow = 0;
+  rd->n_sync = 0;
+}
+
+static race_sync_t* race_sync(race_detector_t* rd, uint32_t word, uint32_t add) {
+  for(uint32_t i = 0; i < rd->n_sync; i++)
+    if(rd->sync[i].word == word)
+      return &rd->sync[i];
+  if(!add) return NULL;
+  if(rd->n_sync == RACE_MAX_SYNC)
+    panic("more than %d synchronization words\n", RACE_MAX_SYNC);
+
+  race_sync_t* s = &rd->sync[rd->n_sync++];
+  s->word = word;
+  memset(s->clock, 0, sizeof(vclock_t));
+  if(rd->sites)
+    add_mem(rd->sites, (void*)word, 4);
+  return s;
+}
+
+// Acquire then release the word's clock
+static void race_sync_access(race_detector_t* rd, race_sync_t* s, uint32_t t) {
+  uint32_t* c = rd->clocks[t];
+  for(uint32_t u = 0; u < rd->n_threads; u++) {
+    if(s->clock[u] > c[u]) c[u] = s->clock[u];
+    s->clock[u] = c[u];
+  }
+  c[t]++;
+}
+
+static race_shadow_t* race_shadow(race_detector_t* rd, uint32_t addr) {
+  uint32_t i = (addr * 0x9E3779B1) % RACE_MAX_BYTES;
+  for(uint32_t n = 0; n < RACE_MAX_BYTES; n++) {
+    race_shadow_t* e = &rd->shadow[i];
+    if(e->addr == addr)
+      return e;
+    if(!e->addr) {
+      e->addr = addr;
+      rd->n_shadow++;
+      return e;
+    }
+    i = (i + 1) % RACE_MAX_BYTES;
+  }
+  return NULL;
+}
+
+static void race_report(
+  race_detector_t* rd, uint32_t addr,
+  uint32_t pc0, uint32_t t0, uint32_t w0,
+  uint32_t pc1, uint32_t t1, uint32_t w1
+) {
+  if(rd->sites)
+    set_insert(rd->sites, addr);
+
+  for(uint32_t i = 0; i < rd->n_reports; i++) {
+    race_report_t* r = &rd->reports[i];
+    if((r->pc[0] == pc0 && r->pc[1] == pc1) || (r->pc[0] == pc1 && r->pc[1] == pc0))
+      return;
+  }
+  if(rd->n_reports == RACE_MAX_REPORTS)
+    return;
+
+  rd->reports[rd->n_reports++] = (race_report_t) {
+    .addr = addr,
+    .pc = { pc0, pc1 },
+    .tid = { t0 + 1, t1 + 1 },
+    .w = { w0, w1 }
+  };
+}
+
+typedef struct {
+  race_detector_t* rd;
+  uint32_t pc, w, t;
+  uint32_t sync;
+  // Last synchronization word handled, so a word is synchronized on once
+  uint32_t last_word;
+  uint32_t stack_start, stack_end;
+} race_touch_t;
+
+static void race_touch_byte(uint32_t addr, void* arg) {
+  race_touch_t* a = arg;
+  race_detector_t* rd = a->rd;
+  uint32_t t = a->t;
+  if(addr >= a->stack_start && addr < a->stack_end) return;
+
+  uint32_t word = addr & ~3;
+  race_sync_t* s = race_sync(rd, word, a->sync);
+  if(s) {
+    if(word != a->last_word)
+      race_sync_access(rd, s, t);
+    a->last_word = word;
+    return;
+  }
+
+  race_shadow_t* e = race_shadow(rd, addr);
+  if(!e) {
+    rd->n_dropped++;
+    return;
+  }
+
+  uint32_t* c = rd->clocks[t];
+  if(e->w_clock && e->w_tid != t && e->w_clock > c[e->w_tid])
+    race_report(rd, addr, e->w_pc, e->w_tid, 1, a->pc, t, a->w);
+
+  if(a->w) {
+    for(uint32_t u = 0; u < rd->n_threads; u++)
+      if(u != t && e->r_clock[u] > c[u])
+        race_report(rd, addr, e->r_pc[u], u, 0, a->pc, t, 1);
+    e->w_clock = c[t];
+    e->w_tid = t;
+    e->w_pc = a->pc;
+  } else {
+    e->r_clock[t] = c[t];
+    e->r_pc[t] = a->pc;
+  }
+}
+
+void race_touch(race_detector_t* rd, set_t* touched, uint32_t pc, uint32_t w, uint32_t tid) {
+  assert(tid >= 1 && tid <= rd->n_threads);
+  race_touch_t a = {
+    .rd = rd,
+    .pc = pc,
+    .w = w,
+    .t = tid - 1,
+    .sync = mem_access_at(pc).exclusive,
+    .last_word = 1
+  };
+  equiv_cur_stack(&a.stack_start, &a.stack_end);
+  set_foreach(touched, race_touch_byte, &a);
+}
+
+void race_print(race_detector_t* rd, memory_tags_t* tags) {
+  for(uint32_t i = 0; i < rd->n_reports; i++) {
+    race_report_t* r = &rd->reports[i];
+    printk("Race on %x", r->addr);
+    char* tag = tags ? get_tag(tags, (void*)r->addr) : NULL;
+    if(tag) {
+      printk(" (");
+      printk(tag);
+      printk(")");
+    }
+    printk(": %x (thread %d %s) and %x (thread %d %s)\n",
+      r->pc[0], r->tid[0], r->w[0] ? "write" : "read",
+      r->pc[1], r->tid[1], r->w[1] ? "write" : "read");
+  }
+  if(rd->n_dropped)
+    printk("Race detector ran out of room for %d access(es)\n", rd->n_dropped);
+}
@@ -0,0 +1,85 @@
+#ifndef __RACE_H
+#define __RACE_H
+
+#include "rpi.h"
+#include "set.h"
+#include "memory.h"
+
+/*
+ * Happens-before data race detection with vector clocks.
+ *
+ * Fed the same touch events as the rest of the checker. Words accessed with
+ * ldrex/strex or swp are synchronization: every access to them (including
+ * later plain stores, like release_vibes) acquires and releases the word's
+ * clock. Every other byte keeps the epoch of its last write and the last read
+ * of each thread. An access that isn't ordered after a conflicting one by
+ * those clocks is a race, whether or not the two actually overlapped in the
+ * run, so a run without preemption is enough to find it.
+ */
+
+#define RACE_MAX_THREADS 8
+// Bytes outside thread stacks remembered during one run
+#define RACE_MAX_BYTES 1024
+#define RACE_MAX_SYNC 64
+// Distinct PC pairs reported
+#define RACE_MAX_REPORTS 64
+
+typedef uint32_t vclock_t[RACE_MAX_THREADS];
+
+typedef struct {
+  // 0 marks an empty slot
+  uint32_t addr;
+  // 0 if never written
+  uint32_t w_clock;
+  uint32_t w_tid;
+  uint32_t w_pc;
+  vclock_t r_clock;
+  uint32_t r_pc[RACE_MAX_THREADS];
+} race_shadow_t;
+
+typedef struct {
+  uint32_t word;
+  vclock_t clock;
+} race_sync_t;
+
+typedef struct {
+  uint32_t addr;
+  // tids are 1-based, w is set for writes
+  uint32_t pc[2], tid[2], w[2];
+} race_report_t;
+
+typedef struct {
+  uint32_t n_threads;
+  vclock_t clocks[RACE_MAX_THREADS];
+
+  race_shadow_t* shadow;
+  uint32_t n_shadow;
+  // Accesses that did not fit in shadow
+  uint32_t n_dropped;
+
+  race_sync_t sync[RACE_MAX_SYNC];
+  uint32_t n_sync;
+
+  race_report_t reports[RACE_MAX_REPORTS];
+  uint32_t n_reports;
+
+  // If not NULL, racing bytes and synchronization words are added here
+  set_t* sites;
+} race_detector_t;
+
+race_detector_t* race_alloc(uint32_t n_threads, set_t* sites);
+void race_free(race_detector_t* rd);
+
+/*
+ * Call before each run. Reports are kept across runs.
+ */
+void race_begin(race_detector_t* rd);
+
+/*
+ * Call on every memory touch event of the run. tid is 1-based.
+ */
+void race_touch(race_detector_t* rd, set_t* touched, uint32_t pc, uint32_t w, uint32_t tid);
+
+void race_print(race_detector_t* rd, memory_tags_t* tags);
+
+#endif
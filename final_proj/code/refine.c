@@ -0,0 +1,122 @@
+#include "refine.h"
+#include "equiv-malloc.h"
+
+refine_t* refine_alloc(set_t* shared_memory) {
+  refine_t* r = equiv_malloc(sizeof(refine_t));
+  if(!r) panic("refinement tracker allocation failed!");
+  memset(r, 0, sizeof(refine_t));
+  r->shared_memory = shared_memory;
+  r->gen = 1;
+  return r;
+}
+
+void refine_free(refine_t* r) {
+  equiv_free(r);
+}
+
+void refine_begin(refine_t* r) {
+  // Forget the previous run without touching the table
+  r->gen++;
+}
+
+static refine_byte_t* refine_byte(refine_t* r, uint32_t addr) {
+  uint32_t i = (addr * 0x9E3779B1) % REFINE_MAX_BYTES;
+  for(uint32_t n = 0; n < REFINE_MAX_BYTES; n++) {
+    refine_byte_t* e = &r->bytes[i];
+    if(e->gen != r->gen) {
+      e->addr = addr;
+      e->readers = e->writers = 0;
+      e->gen = r->gen;
+      return e;
+    }
+    if(e->addr == addr)
+      return e;
+    i = (i + 1) % REFINE_MAX_BYTES;
+  }
+  return NULL;
+}
+
+static void refine_record(refine_t* r, refine_byte_t* e) {
+  for(uint32_t i = 0; i < r->n_found; i++) {
+    if(r->found[i].addr == e->addr) {
+      r->found[i].readers |= e->readers;
+      r->found[i].writers |= e->writers;
+      return;
+    }
+  }
+  if(r->n_found == REFINE_MAX_FOUND) {
+    r->n_full++;
+    return;
+  }
+
+  r->found[r->n_found++] = (refine_found_t) {
+    .addr = e->addr,
+    .readers = e->readers,
+    .writers = e->writers
+  };
+}
+
+typedef struct {
+  refine_t* r;
+  uint32_t w;
+  uint32_t bit;
+} refine_touch_t;
+
+static void refine_touch_byte(uint32_t addr, void* arg) {
+  refine_touch_t* t = arg;
+  refine_t* r = t->r;
+
+  if(set_lookup(r->shared_memory, addr)) return;
+
+  refine_byte_t* e = refine_byte(r, addr);
+  if(!e) {
+    r->n_dropped++;
+    return;
+  }
+
+  uint32_t others = ~t->bit;
+  uint32_t conflict = t->w ? ((e->readers | e->writers) & others) : (e->writers & others);
+  if(t->w) e->writers |= t->bit;
+  else     e->readers |= t->bit;
+
+  if(conflict)
+    refine_record(r, e);
+}
+
+void refine_touch(refine_t* r, set_t* touched, uint32_t w, uint32_t tid) {
+  assert(tid >= 1 && tid <= 32);
+  refine_touch_t t = {
+    .r = r,
+    .w = w,
+    .bit = 1u << (tid - 1)
+  };
+  set_foreach(touched, refine_touch_byte, &t);
+}
+
+uint32_t refine_apply(refine_t* r, set_t** switch_points, uint32_t n_funcs, uint32_t* sym) {
+  uint32_t changed = 0;
+
+  for(uint32_t k = 0; k < r->n_found; k++) {
+    refine_found_t* f = &r->found[k];
+    uint32_t a = f->readers | f->writers;
+    set_insert(r->shared_memory, f->addr);
+
+    // Same rule as find_shared_memory
+    for(uint32_t i = 0; i < n_funcs; i++) {
+      uint32_t others = ~(1u << i);
+      if(!((f->writers & others) || ((f->writers & (1u << i)) && (a & others))))
+        continue;
+      // Copies of a function have to keep the same switch set, or pruning by
+      // symmetry would drop orderings that differ only at this byte
+      for(uint32_t j = 0; j < n_funcs; j++) {
+        if(sym[j] != sym[i] || set_lookup(switch_points[j], f->addr))
+          continue;
+        set_insert(switch_points[j], f->addr);
+        changed |= 1u << j;
+      }
+    }
+  }
+
+  r->n_found = 0;
+  return changed;
+}
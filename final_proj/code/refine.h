@@ -0,0 +1,79 @@
+#ifndef __REFINE_H
+#define __REFINE_H
+
+#include "rpi.h"
+#include "set.h"
+
+/*
+ * Adaptive shared memory refinement.
+ *
+ * find_shared_memory runs every function alone, so it misses accesses that
+ * only happen in some interleavings (e.g. a consumer that only reads the
+ * buffer once the producer has filled it). While schedules run, every access
+ * to a byte outside shared memory is recorded per thread. A byte that one
+ * thread writes and another thread reads or writes in the same run is a
+ * missed conflict: it is collected and later moved into shared memory and
+ * the switch sets of the threads involved.
+ */
+
+// Bytes outside shared memory remembered during one run
+#define REFINE_MAX_BYTES 2048
+// Conflicting bytes collected between two refinements
+#define REFINE_MAX_FOUND 256
+
+typedef struct {
+  uint32_t addr;
+  uint32_t readers;
+  uint32_t writers;
+  // Entry is live iff gen matches the tracker generation
+  uint32_t gen;
+} refine_byte_t;
+
+typedef struct {
+  uint32_t addr;
+  // Threads that accessed the byte in the runs that found it
+  uint32_t readers;
+  uint32_t writers;
+} refine_found_t;
+
+typedef struct {
+  set_t* shared_memory;
+
+  uint32_t gen;
+  refine_byte_t bytes[REFINE_MAX_BYTES];
+  // Accesses that did not fit in bytes
+  uint32_t n_dropped;
+
+  refine_found_t found[REFINE_MAX_FOUND];
+  uint32_t n_found;
+  // Conflicts seen while found was full. Later reruns can pick them up.
+  uint32_t n_full;
+} refine_t;
+
+refine_t* refine_alloc(set_t* shared_memory);
+void refine_free(refine_t* r);
+
+/*
+ * Call before running a schedule
+ */
+void refine_begin(refine_t* r);
+
+/*
+ * Call on every memory touch event of the schedule. tid is 1-based.
+ */
+void refine_touch(refine_t* r, set_t* touched, uint32_t w, uint32_t tid);
+
+static inline uint32_t refine_pending(refine_t* r) {
+  return r->n_found;
+}
+
+/*
+ * Adds the conflicting bytes found so far to shared memory, and to the
+ * switch set of each thread that writes them or reads them while another
+ * thread writes, and of every copy of those threads (sym as filled by
+ * find_symmetric_funcs). Returns a mask (bit tid-1) of the threads whose
+ * switch set grew.
+ */
+uint32_t refine_apply(refine_t* r, set_t** switch_points, uint32_t n_funcs, uint32_t* sym);
+
+#endif
@@ -0,0 +1,188 @@
+#include "result-stream.h"
+#include "equiv-malloc.h"
+#include "equiv-uart.h"
+
+static int enabled = 0;
+static int sent_header = 0;
+
+// Shared memory the current baseline was taken of
+static set_t* base_set = NULL;
+static uint8_t* base_bytes = NULL;
+static uint32_t n_base = 0;
+
+// Records are built here, then framed
+static uint8_t* rec = NULL;
+static uint32_t rec_len, rec_cap;
+
+void result_stream_enable(int on) {
+  enabled = on;
+}
+
+int result_stream_enabled(void) {
+  return enabled;
+}
+
+static void rec_begin(void) {
+  rec_len = 0;
+}
+
+static void rec_put8(uint8_t v) {
+  if(rec_len == rec_cap) {
+    rec_cap = rec_cap ? rec_cap * 2 : 256;
+    rec = equiv_realloc(rec, rec_cap);
+    if(!rec) panic("result record allocation failed!");
+  }
+  rec[rec_len++] = v;
+}
+
+static void rec_put32(uint32_t v) {
+  for(int i = 0; i < 4; i++)
+    rec_put8(v >> (8 * i));
+}
+
+static void rec_put64(uint64_t v) {
+  rec_put32(v);
+  rec_put32(v >> 32);
+}
+
+static void rec_putvar(uint32_t v) {
+  while(v >= 0x80) {
+    rec_put8((v & 0x7F) | 0x80);
+    v >>= 7;
+  }
+  rec_put8(v);
+}
+
+static void rec_send(uint8_t type) {
+  if(rec_len > 0xFFFF) panic("result record too long: %d bytes\n", rec_len);
+  equiv_uart_put8(RESULT_ESC);
+  equiv_uart_put8(type);
+  equiv_uart_put8(rec_len);
+  equiv_uart_put8(rec_len >> 8);
+  for(uint32_t i = 0; i < rec_len; i++)
+    equiv_uart_put8(rec[i]);
+}
+
+static void count_range(uint32_t start, uint32_t len, void* arg) {
+  *(uint32_t*)arg += len;
+}
+
+// Saves the baseline bytes of a run and writes it to the record
+static void baseline_range(uint32_t start, uint32_t len, void* arg) {
+  uint32_t* idx = arg;
+  rec_put32(start);
+  rec_putvar(len);
+  for(uint32_t i = 0; i < len; i++) {
+    uint8_t v = *(volatile uint8_t*)(start + i);
+    base_bytes[(*idx)++] = v;
+    rec_put8(v);
+  }
+}
+
+void result_stream_reset(void) {
+  base_set = NULL;
+  equiv_free(base_bytes);
+  base_bytes = NULL;
+  n_base = 0;
+  equiv_free(rec);
+  rec = NULL;
+  rec_cap = 0;
+}
+
+void result_stream_baseline(set_t* shared_memory, memory_tags_t* tags) {
+  if(!enabled || shared_memory == base_set)
+    return;
+
+  if(!sent_header) {
+    sent_header = 1;
+    rec_begin();
+    rec_put32(RESULT_MAGIC);
+    rec_put8(RESULT_VERSION);
+    rec_send(RESULT_HEADER);
+  }
+
+  if(tags) {
+    for(size_t i = 0; i < tags->n_tags; i++) {
+      rec_begin();
+      rec_put32(tags->tag_bases[i]);
+      for(char* c = tags->tags[i]; *c; c++)
+        rec_put8(*c);
+      rec_send(RESULT_TAG);
+    }
+  }
+
+  uint32_t n = 0;
+  uint32_t n_runs = set_foreach_range(shared_memory, count_range, &n);
+  if(base_bytes) equiv_free(base_bytes);
+  base_bytes = equiv_malloc(n ? n : 1);
+  n_base = n;
+  base_set = shared_memory;
+
+  rec_begin();
+  rec_putvar(n_runs);
+  uint32_t idx = 0;
+  set_foreach_range(shared_memory, baseline_range, &idx);
+  rec_send(RESULT_BASELINE);
+}
+
+typedef struct {
+  uint32_t idx;
+  uint32_t last_diff;
+  uint32_t n_diffs;
+  // Set on the second pass, which writes the diffs
+  uint32_t emit;
+} diff_walk_t;
+
+static void diff_range(uint32_t start, uint32_t len, void* arg) {
+  diff_walk_t* d = arg;
+  for(uint32_t i = 0; i < len; i++, d->idx++) {
+    uint8_t v = *(volatile uint8_t*)(start + i);
+    if(d->idx < n_base && v != base_bytes[d->idx]) {
+      if(d->emit) {
+        rec_putvar(d->idx - d->last_diff);
+        rec_put8(v);
+      }
+      d->last_diff = d->idx;
+      d->n_diffs++;
+    }
+  }
+}
+
+void result_stream_schedule(
+  uint32_t flags, uint64_t id, uint64_t hash,
+  schedule_t* schedule, set_t* shared_memory
+) {
+  assert(enabled);
+  assert(shared_memory == base_set);
+
+  uint32_t ncs = schedule->n_ctx_switches;
+  let report = schedule->report;
+  if(report) flags |= RESULT_HAS_PCS;
+
+  rec_begin();
+  rec_put8(flags);
+  if(flags & RESULT_HAS_ID)
+    rec_put64(id);
+  rec_put64(hash);
+  rec_put8(schedule->n_funcs);
+  rec_putvar(ncs);
+  for(uint32_t i = 0; i <= ncs; i++)
+    rec_put8(schedule->tids[i]);
+  for(uint32_t i = 0; i < ncs; i++)
+    rec_putvar(schedule->instr_counts[i]);
+  if(report) {
+    for(uint32_t i = 0; i < ncs; i++) {
+      rec_putvar(report->n_pcs[i]);
+      for(uint32_t j = 0; j < report->n_pcs[i]; j++)
+        rec_put32(report->pcs[i][j]);
+    }
+  }
+
+  diff_walk_t d = { 0 };
+  set_foreach_range(shared_memory, diff_range, &d);
+  rec_putvar(d.n_diffs);
+  diff_walk_t e = { .emit = 1 };
+  set_foreach_range(shared_memory, diff_range, &e);
+
+  rec_send(RESULT_SCHEDULE);
+}
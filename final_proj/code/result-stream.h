@@ -0,0 +1,80 @@
+#ifndef __RESULT_STREAM_H
+#define __RESULT_STREAM_H
+
+// The host decoder only wants the record layout
+#ifndef RESULT_STREAM_HOST
+#include "rpi.h"
+#include "set.h"
+#include "memory.h"
+#include "equiv-threads.h"
+#endif
+
+/*
+ * Compact binary output of checked schedules.
+ *
+ * Instead of printing memory and schedule tables with printk, results go out
+ * over the UART as framed records mixed into the normal text output. The
+ * host decoder (host/decode-results) turns them back into the usual tables.
+ *
+ * Every record is
+ *    RESULT_ESC type len:u16 payload[len]
+ * RESULT_ESC never appears in printk text, so the decoder passes everything
+ * else through. Integers are little endian, "var" fields are LEB128.
+ *
+ *  RESULT_HEADER    magic:u32 version:u8
+ *  RESULT_TAG       addr:u32 name[len - 4]
+ *  RESULT_BASELINE  n_runs:var { addr:u32 n:var bytes[n] }*
+ *      shared memory right after init, in set order. Schedule records refer
+ *      to these bytes by index.
+ *  RESULT_SCHEDULE  flags:u8 [id:u64] hash:u64 n_funcs:u8 ncs:var
+ *                   tids[ncs+1]:u8 counts[ncs]:var [{ n:var pcs[n]:u32 }[ncs]]
+ *                   n_diffs:var { index delta:var value:u8 }*
+ *      diffs are the shared bytes that differ from the baseline. A slot has
+ *      fewer than counts[i] pcs when its thread blocked before using them up.
+ */
+#define RESULT_ESC 0xFE
+#define RESULT_MAGIC 0x31565145 // "EQV1"
+#define RESULT_VERSION 3
+
+enum {
+  RESULT_HEADER = 'H',
+  RESULT_TAG = 'T',
+  RESULT_BASELINE = 'B',
+  RESULT_SCHEDULE = 'S',
+};
+
+enum {
+  RESULT_INVALID = 1 << 0,
+  RESULT_YIELDED = 1 << 1,
+  RESULT_HAS_ID = 1 << 2,
+  RESULT_HAS_PCS = 1 << 3,
+  // Every unfinished thread was blocked; comes with RESULT_INVALID
+  RESULT_DEADLOCK = 1 << 4,
+};
+
+#ifndef RESULT_STREAM_HOST
+void result_stream_enable(int on);
+int result_stream_enabled(void);
+
+/*
+ * Records the baseline contents of shared memory (and the tags) if they
+ * have not been sent for this set yet. Call after init, before running.
+ */
+void result_stream_baseline(set_t* shared_memory, memory_tags_t* tags);
+
+/*
+ * Forget the baseline, e.g. because the shared memory set changed in place.
+ * Frees the stream's buffers, so call it before the equiv heap is reset.
+ */
+void result_stream_reset(void);
+
+/*
+ * Emits one checked schedule. id is only sent if has_id is set.
+ */
+void result_stream_schedule(
+  uint32_t flags, uint64_t id, uint64_t hash,
+  schedule_t* schedule, set_t* shared_memory
+);
+#endif
+
+#endif
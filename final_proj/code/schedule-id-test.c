@@ -0,0 +1,88 @@
+#include "rpi.h"
+#include "schedule-id.h"
+
+enum { MAX_NCS = 4 };
+
+static uint32_t schedule_valid(schedule_space_t* sp, schedule_t* s) {
+  if(s->n_ctx_switches != sp->n_ctx_switches || s->n_funcs != sp->n_funcs)
+    return 0;
+  for(uint32_t i = 0; i <= sp->n_ctx_switches; i++) {
+    if(s->tids[i] < 1 || s->tids[i] > sp->n_funcs) return 0;
+    if(i && s->tids[i] == s->tids[i-1]) return 0;
+  }
+  return schedule_in_space(sp, s);
+}
+
+// Every ID unranks to a valid schedule that ranks back to it, and walking
+// every schedule directly gives each ID in the space exactly once
+static void check_space(uint32_t n_funcs, uint32_t ncs, uint32_t max_instrs) {
+  assert(ncs <= MAX_NCS);
+  schedule_space_t sp = schedule_space_mk(n_funcs, ncs, max_instrs);
+  uint64_t size = schedule_space_size(&sp);
+
+  uint32_t tids[MAX_NCS + 1], counts[MAX_NCS];
+  schedule_t s = {
+    .tids = tids,
+    .instr_counts = counts,
+    .n_ctx_switches = ncs,
+    .n_funcs = n_funcs,
+    .report = NULL
+  };
+
+  for(uint64_t id = 0; id < size; id++) {
+    schedule_unrank(&sp, id, &s);
+    demand(schedule_valid(&sp, &s), unrank gave an invalid schedule);
+    demand(schedule_rank(&sp, &s) == id, rank of unrank is not the ID);
+  }
+
+  // Odometer over tids (no adjacent repeats) and counts
+  uint8_t seen[512];
+  assert(size <= sizeof(seen));
+  memset(seen, 0, sizeof(seen));
+  uint32_t n = 0;
+  for(uint32_t i = 0; i <= ncs; i++)
+    tids[i] = (i & 1) ? 2 : 1;
+  for(uint32_t i = 0; i < ncs; i++)
+    counts[i] = 1;
+  while(1) {
+    uint64_t id = schedule_rank(&sp, &s);
+    demand(id < size, rank out of the space);
+    demand(!seen[id], two schedules share an ID);
+    seen[id] = 1;
+    n++;
+
+    // Next counts, then next tids
+    uint32_t i = 0;
+    while(i < ncs && counts[i] == max_instrs)
+      counts[i++] = 1;
+    if(i < ncs) {
+      counts[i]++;
+      continue;
+    }
+
+    int j = ncs;
+    for(; j >= 0; j--) {
+      do tids[j]++;
+      while(tids[j] <= n_funcs && j && tids[j] == tids[j-1]);
+      if(tids[j] <= n_funcs) break;
+    }
+    if(j < 0) break;
+    for(uint32_t k = j + 1; k <= ncs; k++)
+      tids[k] = tids[k-1] == 1 ? 2 : 1;
+  }
+  demand(n == size, walk missed schedules);
+
+  printk("%d funcs, %d switches, max_instrs %d: %d IDs round trip\n",
+    n_funcs, ncs, max_instrs, (uint32_t)size);
+}
+
+void notmain() {
+  printk("Testing schedule IDs....\n");
+
+  check_space(1, 0, 1);
+  check_space(3, 0, 3);
+  check_space(2, 1, 1);
+  check_space(3, 2, 3);
+  check_space(2, 4, 2);
+  check_space(4, 2, 2);
+}
@@ -0,0 +1,84 @@
+#include "schedule-id.h"
+
+// IDs are mixed radix numbers, least significant digit first:
+//   tids[0]                               radix n_funcs
+//   then for each switch i:
+//     instr_counts[i] - 1                 radix max_instrs
+//     index of tids[i+1] skipping tids[i] radix n_funcs - 1
+
+static uint64_t mul_checked(uint64_t a, uint64_t b) {
+  if(a && b > UINT64_MAX / a)
+    panic("schedule space does not fit in 64 bits\n");
+  return a * b;
+}
+
+uint64_t schedule_space_size(schedule_space_t* sp) {
+  assert(sp->n_funcs > 1 || sp->n_ctx_switches == 0);
+  assert(sp->max_instrs > 0);
+
+  uint64_t size = sp->n_funcs;
+  for(uint32_t i = 0; i < sp->n_ctx_switches; i++) {
+    size = mul_checked(size, sp->max_instrs);
+    size = mul_checked(size, sp->n_funcs - 1);
+  }
+  return size;
+}
+
+uint32_t schedule_in_space(schedule_space_t* sp, schedule_t* s) {
+  if(s->n_ctx_switches != sp->n_ctx_switches) return 0;
+  for(uint32_t i = 0; i < sp->n_ctx_switches; i++) {
+    if(s->instr_counts[i] < 1 || s->instr_counts[i] > sp->max_instrs)
+      return 0;
+  }
+  return 1;
+}
+
+uint64_t schedule_rank(schedule_space_t* sp, schedule_t* s) {
+  assert(schedule_in_space(sp, s));
+
+  // Horner's rule from the most significant digit down
+  uint64_t id = 0;
+  for(int i = sp->n_ctx_switches - 1; i >= 0; i--) {
+    uint32_t prev = s->tids[i];
+    uint32_t next = s->tids[i+1];
+    assert(next != prev);
+
+    uint32_t tid_digit = next < prev ? next - 1 : next - 2;
+    id = id * (sp->n_funcs - 1) + tid_digit;
+    id = id * sp->max_instrs + (s->instr_counts[i] - 1);
+  }
+  id = id * sp->n_funcs + (s->tids[0] - 1);
+  return id;
+}
+
+void schedule_unrank(schedule_space_t* sp, uint64_t id, schedule_t* s) {
+  s->n_ctx_switches = sp->n_ctx_switches;
+  s->n_funcs = sp->n_funcs;
+
+  s->tids[0] = (id % sp->n_funcs) + 1;
+  id /= sp->n_funcs;
+
+  for(uint32_t i = 0; i < sp->n_ctx_switches; i++) {
+    s->instr_counts[i] = (id % sp->max_instrs) + 1;
+    id /= sp->max_instrs;
+
+    uint32_t tid_digit = id % (sp->n_funcs - 1);
+    id /= sp->n_funcs - 1;
+
+    uint32_t prev = s->tids[i];
+    s->tids[i+1] = tid_digit + 1 < prev ? tid_digit + 1 : tid_digit + 2;
+  }
+  demand(id == 0, schedule ID out of range);
+}
+
+void print_schedule_id(const char* msg, uint64_t id) {
+  if(msg) printk(msg);
+
+  char buf[17];
+  for(int i = 15; i >= 0; i--) {
+    buf[i] = "0123456789abcdef"[id & 0xf];
+    id >>= 4;
+  }
+  buf[16] = 0;
+  printk("0x%s", buf);
+}
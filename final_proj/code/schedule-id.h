@@ -0,0 +1,59 @@
+#ifndef __SCHEDULE_ID_H
+#define __SCHEDULE_ID_H
+
+#include "rpi.h"
+#include "equiv-threads.h"
+
+/*
+ * Bijection between schedules and 64-bit schedule IDs.
+ *
+ * A schedule with n_ctx_switches switches is a tid sequence of
+ * n_ctx_switches + 1 threads with no adjacent repeats, plus an instruction
+ * count in [1, max_instrs] for every switch. IDs are dense: every ID in
+ * [0, schedule_space_size()) maps to exactly one schedule.
+ */
+typedef struct {
+  uint32_t n_funcs;
+  uint32_t n_ctx_switches;
+  // Upper bound on each entry of instr_counts
+  uint32_t max_instrs;
+} schedule_space_t;
+
+static inline schedule_space_t schedule_space_mk(
+  uint32_t n_funcs, uint32_t ncs, uint32_t max_instrs
+) {
+  schedule_space_t sp = {
+    .n_funcs = n_funcs,
+    .n_ctx_switches = ncs,
+    .max_instrs = max_instrs
+  };
+  return sp;
+}
+
+/*
+ * Number of schedules in the space. Panics if it does not fit in 64 bits.
+ */
+uint64_t schedule_space_size(schedule_space_t* sp);
+
+/*
+ * Returns 1 if the schedule can be ranked in this space, 0 otherwise
+ */
+uint32_t schedule_in_space(schedule_space_t* sp, schedule_t* s);
+
+/*
+ * Schedule -> ID. The schedule must be in the space.
+ */
+uint64_t schedule_rank(schedule_space_t* sp, schedule_t* s);
+
+/*
+ * ID -> schedule. s->tids and s->instr_counts must already be allocated with
+ * room for the space's number of context switches.
+ */
+void schedule_unrank(schedule_space_t* sp, uint64_t id, schedule_t* s);
+
+/*
+ * Prints a schedule ID as a 64-bit hex number
+ */
+void print_schedule_id(const char* msg, uint64_t id);
+
+#endif
@@ -2,6 +2,49 @@
 #include "set.h"
 #include "equiv-malloc.h"
 
+// set_foreach_range must give the values of set_foreach, in maximal runs
+typedef struct {
+  uint32_t vals[128];
+  uint32_t n;
+  // Next value the runs have to match
+  uint32_t i;
+  uint32_t n_runs;
+  uint32_t last_end;
+} range_check_t;
+
+static void range_collect(uint32_t v, void* arg) {
+  range_check_t* c = arg;
+  assert(c->n < 128);
+  c->vals[c->n++] = v;
+}
+
+static void range_match(uint32_t start, uint32_t len, void* arg) {
+  range_check_t* c = arg;
+  demand(len, empty run);
+  demand(!c->n_runs || start != c->last_end, adjacent runs were not merged);
+  for(uint32_t k = 0; k < len; k++, c->i++)
+    demand(c->i < c->n && c->vals[c->i] == start + k, run does not match set_foreach);
+  c->n_runs++;
+  c->last_end = start + len;
+}
+
+static void check_ranges(const char* msg, set_t* s, uint32_t n_runs) {
+  range_check_t c = { .n = 0, .i = 0, .n_runs = 0, .last_end = 0 };
+  set_foreach(s, range_collect, &c);
+  uint32_t n = set_foreach_range(s, range_match, &c);
+  demand(c.i == c.n, runs missed values);
+  demand(n == c.n_runs, wrong run count returned);
+  demand(n == n_runs, unexpected number of runs);
+  printk("%s: %d values in %d run(s)\n", msg, c.n, n);
+}
+
+static set_t* set_of_range(uint32_t start, uint32_t len) {
+  set_t* s = set_alloc_offset(MAX_OFFSET);
+  for(uint32_t v = start; v < start + len; v++)
+    set_insert(s, v);
+  return s;
+}
+
 void notmain() {
   enum { MB = 1024 * 1024 };
 
@@ -103,4 +146,34 @@ void notmain() {
   set_intersection_inplace(a, b);
   set_print("A & B\n", a);
 
+  printk("\nTesting ranges....\n");
+
+  check_ranges("Full leaf", set_of_range(0x100, 32), 1);
+  check_ranges("31 bits of a leaf", set_of_range(0xa00, 31), 1);
+  check_ranges("Across a leaf", set_of_range(0x1f0, 32), 1);
+  check_ranges("Across a full leaf", set_of_range(0x3f0, 96), 1);
+
+  a = set_alloc_offset(MAX_OFFSET);
+  set_insert(a, 0x51f);
+  check_ranges("Bit 31 alone", a, 1);
+
+  a = set_alloc_offset(MAX_OFFSET);
+  set_insert(a, 0x71f);
+  set_insert(a, 0x720);
+  check_ranges("Bit 31 into the next leaf", a, 1);
+
+  a = set_alloc_offset(MAX_OFFSET);
+  set_insert(a, 0x800);
+  set_insert(a, 0x81f);
+  check_ranges("Bits 0 and 31", a, 2);
+
+  a = set_of_range(0x900, 4);
+  set_insert(a, 0x905);
+  set_insert(a, 0x91e);
+  set_insert(a, 0x91f);
+  set_insert(a, 0x1000002);
+  check_ranges("Runs with gaps", a, 4);
+
+  a = set_alloc_offset(MAX_OFFSET);
+  check_ranges("Empty", a, 0);
 }
@@ -23,7 +23,7 @@ set_t* set_alloc() {
  * Returns >0 if mask has bit
  */
 static inline uint32_t mask_has(uint32_t mask, uint32_t bit) {
-  return mask & (1 << bit);
+  return mask & (1u << bit);
 }
 
 #define PRINT_INDENT for(int i = 0; i < l; i++) printk("  ");
@@ -80,6 +80,65 @@ uint32_t set_foreach(set_t* s, set_handler_t handler, void* arg) {
   return set_foreach_recurse(s, handler, arg, 0);
 }
 
+typedef struct {
+  set_range_handler_t handler;
+  void* arg;
+  // Run that may still continue into the next leaf
+  uint32_t start, len;
+  uint32_t n;
+} range_walk_t;
+
+static void range_walk_add(range_walk_t* w, uint32_t start, uint32_t len) {
+  if(w->len && start == w->start + w->len) {
+    w->len += len;
+    return;
+  }
+  if(w->len) {
+    w->handler(w->start, w->len, w->arg);
+    w->n++;
+  }
+  w->start = start;
+  w->len = len;
+}
+
+static void set_foreach_range_recurse(set_t* s, range_walk_t* w, uint32_t prefix) {
+  if(s->offset > 0) {
+    for(int i = 0; i < 32; i++) {
+      if(mask_has(s->mask, i)) {
+        set_foreach_range_recurse(s->children[i], w, (prefix << 5) | i);
+      }
+    }
+    return;
+  }
+
+  // Split the leaf mask into runs of set bits
+  uint32_t m = s->mask;
+  while(m) {
+    uint32_t lo = __builtin_ctz(m);
+    uint32_t rest = ~(m >> lo);
+    uint32_t len = rest ? __builtin_ctz(rest) : 32 - lo;
+    range_walk_add(w, (prefix << 5) | lo, len);
+    if(lo + len == 32) break;
+    m &= ~(((1u << len) - 1) << lo);
+  }
+}
+
+uint32_t set_foreach_range(set_t* s, set_range_handler_t handler, void* arg) {
+  range_walk_t w = {
+    .handler = handler,
+    .arg = arg,
+    .start = 0,
+    .len = 0,
+    .n = 0
+  };
+  set_foreach_range_recurse(s, &w, 0);
+  if(w.len) {
+    handler(w.start, w.len, arg);
+    w.n++;
+  }
+  return w.n;
+}
+
 uint32_t set_empty(set_t* s) {
   if(set_cardinality(s) == 0) return 1;
   else return 0;
@@ -97,7 +156,7 @@ void set_copy(set_t* dst, set_t* src) {
   dst->mask = src->mask;
   if(src->offset > 0) {
     for(int i = 0; i < 32; i++) {
-      uint32_t bit = 0x1 << i;
+      uint32_t bit = 0x1u << i;
       if(src->mask & bit) {
         dst->children[i] = set_alloc_offset(src->offset - 5);
         set_copy(dst->children[i], src->children[i]);
@@ -109,7 +168,7 @@ void set_copy(set_t* dst, set_t* src) {
 uint32_t set_insert(set_t* s, uint32_t v) {
   uint32_t index = (v >> s->offset) & 0x1F;
 
-  uint32_t bit = 0x1 << index;
+  uint32_t bit = 0x1u << index;
   uint32_t present = s->mask & bit;
 
   s->mask |= bit;
@@ -129,7 +188,7 @@ uint32_t set_insert(set_t* s, uint32_t v) {
 uint32_t set_lookup(set_t* s, uint32_t v) {
   uint32_t index = (v >> s->offset) & 0x1F;
 
-  uint32_t bit = 0x1 << index;
+  uint32_t bit = 0x1u << index;
   uint32_t present = s->mask & bit;
 
   // If the prefix is not present in the set, give up
@@ -56,6 +56,14 @@ void set_dump(const char* msg, set_t* s);
 typedef void (*set_handler_t)(uint32_t v, void* arg);
 uint32_t set_foreach(set_t* s, set_handler_t handler, void* arg);
 
+/*
+ * Calls handler once for each run of consecutive values [start, start + len),
+ * in ascending order. Runs are found from the leaf masks, so a large array
+ * costs one call instead of one per byte. Returns the number of runs.
+ */
+typedef void (*set_range_handler_t)(uint32_t start, uint32_t len, void* arg);
+uint32_t set_foreach_range(set_t* s, set_range_handler_t handler, void* arg);
+
 /*
  * Returns 1 if set is empty, 0 otherwise
  */
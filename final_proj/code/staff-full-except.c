@@ -12,6 +12,8 @@
 //  - only handles data/prefetch abort/syscall (easy to change)
 //  - only handles a single override: in reality may want a stack of these.
 //  - pretty slow.  can do various tricks (JIT + customize and swap vectors).
+//    the checker's user-mode steps and data aborts take the fast vectors in
+//    full-except-asm.S instead.
 //  - really should add a data pointer.
 //  - probably should have one set handler that takes a argument.
 //
@@ -24,6 +26,7 @@
 #include "vector-base.h"
 #include "full-except.h"
 #include "cpsr-util.h"
+#include "equiv-uart.h"
 
 void mode_get_lr_sp_asm(uint32_t mode, uint32_t *sp, uint32_t *lr);
 
@@ -50,7 +53,7 @@ void prefetch_abort_full_except(regs_t *r, uint32_t spsr, uint32_t pc) {
     assert(pc == r->regs[REGS_PC]);
 
     if(!prefetch_handler)
-        panic("unhandled prefetch abort from pc=%x\n", pc);
+        equiv_panic("unhandled prefetch abort from pc=%x\n", pc);
     fixup_regs(r, spsr);
     prefetch_handler(r);
     switchto(r);
@@ -63,7 +66,7 @@ void data_abort_full_except(regs_t *r, uint32_t spsr, uint32_t pc) {
     assert(pc == r->regs[REGS_PC]);
 
     if(!data_abort_handler)
-        panic("unhandled data abort from pc=%x\n", pc);
+        equiv_panic("unhandled data abort from pc=%x\n", pc);
 
     // we should swap the handlers depending on where we are jumping to.
     fixup_regs(r, spsr);
@@ -71,13 +74,30 @@ void data_abort_full_except(regs_t *r, uint32_t spsr, uint32_t pc) {
     switchto(r);
 }
 
+// user-mode entries from the fast vectors in <full-except-asm.S>.  the
+// registers are already right, so no fixup, and the pc/spsr checks above
+// would only re-read what the trampoline just stored.
+void prefetch_abort_user_except(regs_t *r) {
+    if(!prefetch_handler)
+        equiv_panic("unhandled prefetch abort from pc=%x\n", r->regs[REGS_PC]);
+    prefetch_handler(r);
+    switchto(r);
+}
+
+void data_abort_user_except(regs_t *r) {
+    if(!data_abort_handler)
+        equiv_panic("unhandled data abort from pc=%x\n", r->regs[REGS_PC]);
+    data_abort_handler(r);
+    switchto(r);
+}
+
 int syscall_full_except(regs_t *r, uint32_t spsr, uint32_t pc) {
     // pass seperately so can sanity check
     assert(spsr == r->regs[REGS_CPSR]);
     assert(pc == r->regs[REGS_PC]);
 
     if(mode_get(spsr) != USER_MODE)
-        panic("only handling system calls from user mode.\n");
+        equiv_panic("only handling system calls from user mode.\n");
 
     // should check these in general.  also that its near the
     // interrupt stack address.
@@ -87,7 +107,7 @@ int syscall_full_except(regs_t *r, uint32_t spsr, uint32_t pc) {
     // if we are at SUPER level would just need to subtract 68 from
     // sp, but getting the original would be a pain.
     if(!syscall_handler)
-        panic("unhandled syscall from pc=%x\n", pc);
+        equiv_panic("unhandled syscall from pc=%x\n", pc);
 
     // if they return just roll with it.
     r->regs[0] =  syscall_handler(r);
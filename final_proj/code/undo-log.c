@@ -0,0 +1,66 @@
+#include "undo-log.h"
+#include "equiv-malloc.h"
+
+undo_log_t* undo_log_alloc(void) {
+  undo_log_t* l = equiv_malloc(sizeof(undo_log_t));
+  if(!l) panic("undo log allocation failed!");
+  l->entries = equiv_malloc(sizeof(undo_entry_t) * UNDO_LOG_CAP);
+  if(!l->entries) panic("undo log allocation failed!");
+  l->n = 0;
+  l->overflowed = 0;
+  l->n_overflows = 0;
+  return l;
+}
+
+void undo_log_free(undo_log_t* l) {
+  equiv_free(l->entries);
+  equiv_free(l);
+}
+
+void undo_log_begin(undo_log_t* l) {
+  l->n = 0;
+  l->overflowed = 0;
+}
+
+typedef struct {
+  undo_log_t* l;
+  uint32_t skip_start;
+  uint32_t skip_end;
+} undo_record_t;
+
+static void undo_log_byte(uint32_t addr, void* arg) {
+  undo_record_t* r = arg;
+  undo_log_t* l = r->l;
+  if(addr >= r->skip_start && addr < r->skip_end) return;
+  if(l->n == UNDO_LOG_CAP) {
+    l->overflowed = 1;
+    return;
+  }
+  l->entries[l->n++] = (undo_entry_t) {
+    .addr = addr,
+    .old = *(volatile uint8_t*)addr
+  };
+}
+
+void undo_log_record(undo_log_t* l, set_t* touched, uint32_t skip_start, uint32_t skip_end) {
+  if(l->overflowed) return;
+  undo_record_t r = {
+    .l = l,
+    .skip_start = skip_start,
+    .skip_end = skip_end
+  };
+  set_foreach(touched, undo_log_byte, &r);
+  if(l->overflowed) l->n_overflows++;
+}
+
+uint32_t undo_log_rollback(undo_log_t* l) {
+  if(l->overflowed) return 0;
+
+  // Backwards, so the oldest saved value of each byte is written last
+  for(uint32_t i = l->n; i > 0; i--) {
+    undo_entry_t* e = &l->entries[i - 1];
+    *(volatile uint8_t*)e->addr = e->old;
+  }
+  l->n = 0;
+  return 1;
+}
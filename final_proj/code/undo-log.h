@@ -0,0 +1,57 @@
+#ifndef __UNDO_LOG_H
+#define __UNDO_LOG_H
+
+#include "rpi.h"
+#include "set.h"
+
+/*
+ * Undo log for resetting memory between schedules.
+ *
+ * The data abort fires before the faulting store commits, so the touch
+ * handler can save the bytes a write is about to overwrite. Replaying the
+ * log backwards puts memory back the way it was when the log was started,
+ * at a cost that only depends on how much the schedule wrote.
+ *
+ * Only tracked writes are logged: accesses to the user domain never fault,
+ * so memory there is not restored.
+ */
+
+// Entries kept for one schedule. A schedule that writes more bytes than this
+// can't be rolled back and init has to run again
+#define UNDO_LOG_CAP 4096
+
+typedef struct {
+  uint32_t addr;
+  uint8_t old;
+} undo_entry_t;
+
+typedef struct {
+  undo_entry_t* entries;
+  uint32_t n;
+  uint32_t overflowed;
+  // Schedules that could not be rolled back
+  uint32_t n_overflows;
+} undo_log_t;
+
+undo_log_t* undo_log_alloc(void);
+void undo_log_free(undo_log_t* l);
+
+/*
+ * Starts logging from the current memory state
+ */
+void undo_log_begin(undo_log_t* l);
+
+/*
+ * Saves the current contents of the bytes a write is about to touch. Bytes
+ * in [skip_start, skip_end) are not saved, which is meant for the stack of
+ * the running thread: it is reset along with the registers anyway.
+ */
+void undo_log_record(undo_log_t* l, set_t* touched, uint32_t skip_start, uint32_t skip_end);
+
+/*
+ * Restores memory to the state at undo_log_begin. Returns 0 (and restores
+ * nothing) if the log overflowed.
+ */
+uint32_t undo_log_rollback(undo_log_t* l);
+
+#endif
@@ -0,0 +1,46 @@
+#include "user-scan.h"
+#include "equiv-rw-set.h"
+#include "mini-step.h"
+
+extern uint32_t __user_start__[];
+extern uint32_t __user_end__[];
+
+// One bit per instruction in [user_start, user_end)
+static uint32_t* mem_pcs;
+static uint32_t user_start, user_end;
+static uint32_t n_mem_pcs;
+
+void user_scan_init(void) {
+  // __user_start__ is placed before the ALIGN(4)
+  user_start = ((uint32_t)__user_start__ + 3) & ~3;
+  user_end = (uint32_t)__user_end__ & ~3;
+  if(user_end < user_start) user_end = user_start;
+
+  uint32_t n = (user_end - user_start) / 4;
+  mem_pcs = kmalloc((n + 31) / 32 * 4 + 4);
+  memset(mem_pcs, 0, (n + 31) / 32 * 4 + 4);
+
+  n_mem_pcs = 0;
+  for(uint32_t i = 0; i < n; i++) {
+    mem_access_t a = mem_access_decode(GET32(user_start + i * 4));
+    if(a.n_bytes) {
+      mem_pcs[i / 32] |= 1 << (i % 32);
+      n_mem_pcs++;
+    }
+  }
+
+  // The prefetch fast path arms from the same bitmap
+  step_fast.scan_bits = mem_pcs;
+  step_fast.scan_start = user_start;
+  step_fast.scan_end = user_end;
+
+  printk("Found %d load/store PCs in %d .user instructions\n", n_mem_pcs, n);
+}
+
+uint32_t user_scan_may_access(uint32_t pc) {
+  if(!mem_pcs || pc < user_start || pc >= user_end)
+    return 1;
+
+  uint32_t i = (pc - user_start) / 4;
+  return (mem_pcs[i / 32] >> (i % 32)) & 1;
+}
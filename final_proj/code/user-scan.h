@@ -0,0 +1,28 @@
+#ifndef __USER_SCAN_H
+#define __USER_SCAN_H
+
+#include "rpi.h"
+
+/*
+ * Static load/store discovery for the .user section.
+ *
+ * Every word between __user_start__ and __user_end__ is decoded once with
+ * mem_access_decode (the decoding the data abort handler uses), so which
+ * PCs can touch memory is known before anything runs. Data words that
+ * happen to decode as loads/stores are kept, so the set can have false
+ * positives but never misses an instruction.
+ */
+
+/*
+ * Scans .user. Must run after the section has been copied to its link
+ * address. Allocates from the kmalloc heap, so once per boot.
+ */
+void user_scan_init(void);
+
+/*
+ * 1 if the instruction at pc can access memory. PCs outside .user (or
+ * before user_scan_init) always can.
+ */
+uint32_t user_scan_may_access(uint32_t pc);
+
+#endif